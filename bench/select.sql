@@ -0,0 +1,33 @@
+-- Comparisons per value that median() takes to select the median of int8
+-- input, on McIlroy's adversary and on the classic median-of-three killer
+-- sequences. Linear-time selection keeps them constant as n grows.
+--
+-- Run with "make bench" against a server where the extension is installed,
+-- on the machine where it was built: the counting functions come from the
+-- median_bench module in the build directory, passed as :bench_module. That
+-- module uses symbols of median itself, so median is loaded first.
+
+LOAD 'median';
+
+CREATE FUNCTION pg_temp.median_select_comparisons(int8[]) RETURNS float8
+AS :'bench_module', 'median_select_comparisons' LANGUAGE C STRICT;
+CREATE FUNCTION pg_temp.median_select_adversary_comparisons(int8) RETURNS float8
+AS :'bench_module', 'median_select_adversary_comparisons' LANGUAGE C STRICT;
+
+SELECT n,
+       round(pg_temp.median_select_adversary_comparisons(n)::numeric, 1) AS adversary,
+       round(pg_temp.median_select_comparisons(
+           ARRAY(SELECT (random() * 1e9)::int8 FROM generate_series(1, n)))::numeric, 1) AS random,
+       round(pg_temp.median_select_comparisons(
+           ARRAY(SELECT CASE WHEN i <= n / 2 THEN i ELSE n + 1 - i END
+                 FROM generate_series(1, n) AS i))::numeric, 1) AS organ_pipe,
+       round(pg_temp.median_select_comparisons(
+           ARRAY(SELECT CASE WHEN i <= n / 2 AND i % 2 = 1 THEN i
+                             WHEN i <= n / 2 THEN n / 2 + i - 1
+                             ELSE 2 * (i - n / 2) END
+                 FROM generate_series(1, n) AS i))::numeric, 1) AS musser,
+       round(pg_temp.median_select_comparisons(
+           ARRAY(SELECT i % 100 FROM generate_series(1, n) AS i))::numeric, 1) AS sawtooth,
+       round(pg_temp.median_select_comparisons(
+           ARRAY(SELECT i % 3 FROM generate_series(1, n) AS i))::numeric, 1) AS few_distinct
+FROM unnest(ARRAY[10000, 100000, 1000000]::int8[]) AS n;
@@ -0,0 +1,278 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <libpq/pqformat.h>
+#include <utils/builtins.h>
+#include <utils/timestamp.h>
+
+#include "median_compat.h"
+#include "quantile_sketch.h"
+
+/*
+ * Exponentially decayed median.
+ *
+ * decayed_median(ts, val, half_life) is the weighted median of val where
+ * each value weighs 2^((ts - L) / half_life) for a landmark time L. This is
+ * forward decay: the weight of a value is fixed when it arrives, yet a value
+ * half_life older than another counts half as much, and since the median
+ * only depends on relative weights, L can be any time at all. It starts out
+ * as the first timestamp seen and is moved forward, scaling all weights down
+ * by the same factor, before newer weights would overflow.
+ *
+ * The weights are summed in a quantile sketch (see quantile_sketch.h), so
+ * the result is within 1% of the exact weighted median while state and
+ * per-row cost are constant. The sketches of two states merge by adding up
+ * their buckets once they are scaled to a common landmark, which allows
+ * parallel aggregation.
+ */
+
+/* Largest weight exponent before the landmark is moved forward */
+#define DECAYED_MAX_EXPONENT		512
+
+/*
+ * Exponent beyond which moving the landmark would scale all weights so far
+ * out of the range of doubles
+ */
+#define DECAYED_RESET_EXPONENT		1100
+
+PG_FUNCTION_INFO_V1(decayed_median_transfn);
+PG_FUNCTION_INFO_V1(decayed_median_finalfn);
+PG_FUNCTION_INFO_V1(decayed_median_combinefn);
+PG_FUNCTION_INFO_V1(decayed_median_serialfn);
+PG_FUNCTION_INFO_V1(decayed_median_deserialfn);
+
+typedef struct DecayedMedianState
+{
+	int64		half_life;		/* in microseconds */
+	TimestampTz landmark;
+	QuantileSketch sketch;
+} DecayedMedianState;
+
+static DecayedMedianState *decayed_init(MemoryContext agg_context, int64 half_life,
+										TimestampTz landmark);
+static void decayed_rescale(DecayedMedianState *state, TimestampTz ts);
+
+static DecayedMedianState *
+decayed_init(MemoryContext agg_context, int64 half_life, TimestampTz landmark)
+{
+	DecayedMedianState *state;
+
+	state = (DecayedMedianState *) MemoryContextAllocZero(agg_context, sizeof(DecayedMedianState));
+	state->half_life = half_life;
+	state->landmark = landmark;
+	quantile_sketch_init(&state->sketch, agg_context, QUANTILE_SKETCH_RELATIVE_ACCURACY);
+	return state;
+}
+
+/*
+ * Move the landmark forward by a whole number of half-lives, so that a
+ * value at ts gets a weight that fits comfortably. If ts is so far ahead
+ * that the weights so far would vanish next to its weight, they are dropped
+ * and the landmark becomes ts.
+ */
+static void
+decayed_rescale(DecayedMedianState *state, TimestampTz ts)
+{
+	double		exponent = ((double) ts - state->landmark) / state->half_life;
+	int			shift;
+
+	if (exponent > DECAYED_RESET_EXPONENT)
+	{
+		quantile_sketch_clear(&state->sketch);
+		state->landmark = ts;
+		return;
+	}
+
+	shift = (int) floor(exponent);
+	quantile_sketch_scale(&state->sketch, -shift);
+	state->landmark += (TimestampTz) shift * state->half_life;
+}
+
+/*
+ * Decayed median transition function.
+ *
+ * Rows with a NULL timestamp or value are ignored. The half-life is taken
+ * from the first row; like the fraction of percentile_disc it is expected to
+ * be a constant.
+ */
+Datum
+decayed_median_transfn(PG_FUNCTION_ARGS)
+{
+	DecayedMedianState *state = NULL;
+	MemoryContext agg_context;
+	TimestampTz ts;
+	double		value;
+	double		exponent;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "decayed_median_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		state = (DecayedMedianState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		PG_RETURN_POINTER(state);
+
+	ts = PG_GETARG_TIMESTAMPTZ(1);
+	value = PG_GETARG_FLOAT8(2);
+	if (TIMESTAMP_NOT_FINITE(ts))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+				 errmsg("decayed_median timestamps must be finite")));
+	if (isnan(value) || isinf(value))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("decayed_median input values must be finite")));
+
+	if (state == NULL)
+	{
+		Interval   *half_life;
+		double		usecs = 0;
+
+		if (!PG_ARGISNULL(3))
+		{
+			half_life = PG_GETARG_INTERVAL_P(3);
+			usecs = half_life->time +
+				((double) half_life->month * DAYS_PER_MONTH + half_life->day) * USECS_PER_DAY;
+		}
+		if (!(usecs > 0) || usecs > PG_INT64_MAX)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("decayed_median half-life must be a positive interval")));
+
+		state = decayed_init(agg_context, (int64) usecs, ts);
+	}
+
+	exponent = ((double) ts - state->landmark) / state->half_life;
+	if (exponent > DECAYED_MAX_EXPONENT)
+	{
+		decayed_rescale(state, ts);
+		exponent = ((double) ts - state->landmark) / state->half_life;
+	}
+
+	/* Weights of values from far before the landmark can underflow to zero */
+	quantile_sketch_add(&state->sketch, value, exp2(exponent));
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Decayed median final function.
+ */
+Datum
+decayed_median_finalfn(PG_FUNCTION_ARGS)
+{
+	DecayedMedianState *state;
+	double		result;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "decayed_median_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (DecayedMedianState *) PG_GETARG_POINTER(0);
+	if (state == NULL || !quantile_sketch_quantile(&state->sketch, 0.5, &result))
+		PG_RETURN_NULL();
+
+	PG_RETURN_FLOAT8(result);
+}
+
+/*
+ * Decayed median combine function.
+ *
+ * The weights of the state with the earlier landmark are scaled to the
+ * later one before the buckets are added up.
+ */
+Datum
+decayed_median_combinefn(PG_FUNCTION_ARGS)
+{
+	DecayedMedianState *state1;
+	DecayedMedianState *state2;
+	MemoryContext agg_context;
+	double		scale;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "decayed_median_combinefn called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (DecayedMedianState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (DecayedMedianState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+	{
+		if (state1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
+	}
+
+	if (state1 == NULL)
+		state1 = decayed_init(agg_context, state2->half_life, state2->landmark);
+	else if (state1->half_life != state2->half_life)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("decayed_median half-life must be the same for all rows")));
+
+	/*
+	 * The rescaling moves the landmark by whole half-lives only, so state2 is
+	 * scaled by up to a factor of two for the rest. If state2's landmark is
+	 * far behind, its weights underflow to zero.
+	 */
+	if (state2->landmark > state1->landmark)
+		decayed_rescale(state1, state2->landmark);
+	scale = exp2(((double) state2->landmark - state1->landmark) / state1->half_life);
+
+	quantile_sketch_merge(&state1->sketch, &state2->sketch, scale);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * Decayed median serialization function.
+ */
+Datum
+decayed_median_serialfn(PG_FUNCTION_ARGS)
+{
+	DecayedMedianState *state;
+	StringInfoData buf;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "decayed_median_serialfn called in non-aggregate context");
+
+	state = (DecayedMedianState *) PG_GETARG_POINTER(0);
+
+	pq_begintypsend(&buf);
+	pq_sendint64(&buf, state->half_life);
+	pq_sendint64(&buf, state->landmark);
+	quantile_sketch_send(&buf, &state->sketch);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * Decayed median deserialization function.
+ */
+Datum
+decayed_median_deserialfn(PG_FUNCTION_ARGS)
+{
+	bytea	   *sstate;
+	DecayedMedianState *state;
+	MemoryContext agg_context;
+	StringInfoData buf;
+	int64		half_life;
+	TimestampTz landmark;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "decayed_median_deserialfn called in non-aggregate context");
+
+	sstate = PG_GETARG_BYTEA_PP(0);
+
+	buf.data = VARDATA_ANY(sstate);
+	buf.len = VARSIZE_ANY_EXHDR(sstate);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+
+	half_life = pq_getmsgint64(&buf);
+	landmark = pq_getmsgint64(&buf);
+	state = decayed_init(agg_context, half_life, landmark);
+	quantile_sketch_receive(&state->sketch, &buf);
+	pq_getmsgend(&buf);
+
+	PG_RETURN_POINTER(state);
+}
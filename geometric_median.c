@@ -0,0 +1,406 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/geo_decls.h>
+#include "catalog/pg_type_d.h"
+
+#include "median_compat.h"
+
+/*
+ * Geometric median aggregates.
+ *
+ * The geometric median of a set of points is the point that minimizes the
+ * sum of Euclidean distances to all points of the set. Unlike the
+ * per-coordinate median it does not depend on the choice of axes, which makes
+ * it the natural robust center of e.g. GPS positions. It has no closed form,
+ * so the transition functions only buffer the coordinates and the final
+ * function runs Weiszfeld's algorithm over them.
+ *
+ * Coordinates are buffered as a structure of arrays (one array per
+ * dimension) so that the distance and weighting loops of each iteration run
+ * over contiguous doubles and can be vectorized by the compiler.
+ */
+
+#define GEOMEDIAN_INITIAL_CAPACITY	64
+#define GEOMEDIAN_DEFAULT_TOLERANCE	1e-9
+#define GEOMEDIAN_MAX_ITERATIONS	1000
+
+/*
+ * Distance below which an iterate is considered to coincide with an input
+ * point, relative to the magnitude of the iterate.
+ */
+#define GEOMEDIAN_COINCIDENT_EPSILON 1e-12
+
+PG_FUNCTION_INFO_V1(geometric_median_point_transfn);
+PG_FUNCTION_INFO_V1(geometric_median_point_finalfn);
+PG_FUNCTION_INFO_V1(geometric_median_array_transfn);
+PG_FUNCTION_INFO_V1(geometric_median_array_finalfn);
+
+/* Buffered input points, one coordinate array per dimension */
+typedef struct GeoMedianState
+{
+	int			dim;
+	int64		num_points;
+	int64		capacity;
+	double		tolerance;
+	double	  **coords;			/* coords[d][i] is coordinate d of point i */
+	MemoryContext agg_context;
+} GeoMedianState;
+
+static GeoMedianState *geomedian_init(MemoryContext agg_context, int dim,
+									  double tolerance);
+static double geomedian_get_tolerance(FunctionCallInfo fcinfo, int argno);
+static void geomedian_append(GeoMedianState *state, const double *point);
+static void geomedian_distances(const GeoMedianState *state, const double *y,
+								double *dist);
+static void geomedian_solve(const GeoMedianState *state, double *y);
+
+static GeoMedianState *
+geomedian_init(MemoryContext agg_context, int dim, double tolerance)
+{
+	GeoMedianState *state;
+	int			d;
+
+	state = (GeoMedianState *) MemoryContextAlloc(agg_context, sizeof(GeoMedianState));
+	state->dim = dim;
+	state->num_points = 0;
+	state->capacity = GEOMEDIAN_INITIAL_CAPACITY;
+	state->tolerance = tolerance;
+	state->agg_context = agg_context;
+	state->coords = (double **) MemoryContextAlloc(agg_context, dim * sizeof(double *));
+	for (d = 0; d < dim; d++)
+		state->coords[d] = (double *) MemoryContextAllocHuge(agg_context,
+															 state->capacity * sizeof(double));
+	return state;
+}
+
+/*
+ * Read the optional tolerance argument. It is taken from the first row only;
+ * like the fraction of percentile_disc it is expected to be a constant.
+ */
+static double
+geomedian_get_tolerance(FunctionCallInfo fcinfo, int argno)
+{
+	double		tolerance;
+
+	if (PG_NARGS() <= argno || PG_ARGISNULL(argno))
+		return GEOMEDIAN_DEFAULT_TOLERANCE;
+
+	tolerance = PG_GETARG_FLOAT8(argno);
+	if (!(tolerance > 0) || isinf(tolerance))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("geometric_median tolerance must be a positive number")));
+	return tolerance;
+}
+
+static void
+geomedian_append(GeoMedianState *state, const double *point)
+{
+	int64		i = state->num_points;
+	int			d;
+
+	if (i == state->capacity)
+	{
+		state->capacity *= 2;
+		for (d = 0; d < state->dim; d++)
+			state->coords[d] = (double *) repalloc_huge(state->coords[d],
+														state->capacity * sizeof(double));
+	}
+
+	for (d = 0; d < state->dim; d++)
+	{
+		if (isnan(point[d]) || isinf(point[d]))
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("geometric_median input coordinates must be finite")));
+		state->coords[d][i] = point[d];
+	}
+	state->num_points++;
+}
+
+/*
+ * Compute the Euclidean distance of every buffered point to y.
+ *
+ * This is the hot loop of every iteration. Squared distances are accumulated
+ * one dimension at a time so that each inner loop is a plain pass over two
+ * contiguous arrays.
+ */
+static void
+geomedian_distances(const GeoMedianState *state, const double *y, double *dist)
+{
+	int64		n = state->num_points;
+	int64		i;
+	int			d;
+
+	memset(dist, 0, n * sizeof(double));
+	for (d = 0; d < state->dim; d++)
+	{
+		const double *restrict c = state->coords[d];
+		double		yd = y[d];
+
+		for (i = 0; i < n; i++)
+		{
+			double		diff = c[i] - yd;
+
+			dist[i] += diff * diff;
+		}
+	}
+	for (i = 0; i < n; i++)
+		dist[i] = sqrt(dist[i]);
+}
+
+/*
+ * Weiszfeld's algorithm, starting at the centroid.
+ *
+ * Each step moves to the average of the input points weighted by the inverse
+ * of their distance to the current iterate. When the iterate coincides with
+ * input points their weight is undefined; we then use the Vardi-Zhang
+ * modification, which either proves the iterate optimal or moves away from
+ * it. The result is stored in y, which must have room for state->dim values.
+ */
+static void
+geomedian_solve(const GeoMedianState *state, double *y)
+{
+	int64		n = state->num_points;
+	int			dim = state->dim;
+	double	   *w = (double *) palloc_extended(n * sizeof(double), MCXT_ALLOC_HUGE);
+	double	   *num = (double *) palloc(dim * sizeof(double));
+	int64		i;
+	int			d;
+	int			iter;
+
+	/* Start at the centroid */
+	for (d = 0; d < dim; d++)
+	{
+		const double *c = state->coords[d];
+		double		sum = 0;
+
+		for (i = 0; i < n; i++)
+			sum += c[i];
+		y[d] = sum / n;
+	}
+
+	for (iter = 0; iter < GEOMEDIAN_MAX_ITERATIONS; iter++)
+	{
+		double		ynorm = 0;
+		double		epsilon;
+		double		sum_w = 0;
+		double		r = 0;
+		double		step = 0;
+		int64		coincident = 0;
+
+		for (d = 0; d < dim; d++)
+			ynorm += y[d] * y[d];
+		epsilon = GEOMEDIAN_COINCIDENT_EPSILON * (1 + sqrt(ynorm));
+
+		/* Turn distances into weights, excluding coincident points */
+		geomedian_distances(state, y, w);
+		for (i = 0; i < n; i++)
+		{
+			if (w[i] > epsilon)
+			{
+				w[i] = 1 / w[i];
+				sum_w += w[i];
+			}
+			else
+			{
+				w[i] = 0;
+				coincident++;
+			}
+		}
+
+		/* All points sit on the iterate */
+		if (sum_w == 0)
+			break;
+
+		for (d = 0; d < dim; d++)
+		{
+			const double *restrict c = state->coords[d];
+			double		sum = 0;
+
+			for (i = 0; i < n; i++)
+				sum += c[i] * w[i];
+			num[d] = sum;
+		}
+
+		/*
+		 * Vardi-Zhang: with R the sum of the unit vectors from the iterate
+		 * towards the other points, the iterate is optimal if |R| does not
+		 * exceed the number of coincident points.
+		 */
+		if (coincident > 0)
+		{
+			for (d = 0; d < dim; d++)
+			{
+				double		rd = num[d] - y[d] * sum_w;
+
+				r += rd * rd;
+			}
+			r = sqrt(r);
+			if (r <= coincident)
+				break;
+		}
+
+		for (d = 0; d < dim; d++)
+		{
+			double		next = num[d] / sum_w;
+			double		diff;
+
+			if (coincident > 0)
+			{
+				double		gamma = coincident / r;
+
+				next = (1 - gamma) * next + gamma * y[d];
+			}
+			diff = next - y[d];
+			step += diff * diff;
+			y[d] = next;
+		}
+
+		if (sqrt(step) <= state->tolerance)
+			break;
+	}
+
+	pfree(w);
+	pfree(num);
+}
+
+/*
+ * Geometric median transition function for points.
+ *
+ * Takes an optional second argument with the convergence tolerance. NULL
+ * points are ignored.
+ */
+Datum
+geometric_median_point_transfn(PG_FUNCTION_ARGS)
+{
+	GeoMedianState *state;
+	MemoryContext agg_context;
+	Point	   *p;
+	double		point[2];
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "geometric_median_point_transfn called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		state = geomedian_init(agg_context, 2, geomedian_get_tolerance(fcinfo, 2));
+	else
+		state = (GeoMedianState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	p = PG_GETARG_POINT_P(1);
+	point[0] = p->x;
+	point[1] = p->y;
+	geomedian_append(state, point);
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Geometric median final function for points.
+ */
+Datum
+geometric_median_point_finalfn(PG_FUNCTION_ARGS)
+{
+	GeoMedianState *state;
+	Point	   *result;
+	double		y[2];
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "geometric_median_point_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (GeoMedianState *) PG_GETARG_POINTER(0);
+	if (state == NULL || state->num_points == 0)
+		PG_RETURN_NULL();
+
+	geomedian_solve(state, y);
+
+	result = (Point *) palloc(sizeof(Point));
+	result->x = y[0];
+	result->y = y[1];
+	PG_RETURN_POINT_P(result);
+}
+
+/*
+ * Geometric median transition function for float8[] coordinates.
+ *
+ * All non-NULL arrays must be one-dimensional, free of NULL elements and of
+ * the same length, which fixes the dimension of the space. Takes an optional
+ * second argument with the convergence tolerance.
+ */
+Datum
+geometric_median_array_transfn(PG_FUNCTION_ARGS)
+{
+	GeoMedianState *state = NULL;
+	MemoryContext agg_context;
+	ArrayType  *arr;
+	int			dim;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "geometric_median_array_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		state = (GeoMedianState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	arr = PG_GETARG_ARRAYTYPE_P(1);
+	if (ARR_NDIM(arr) != 1 || array_contains_nulls(arr))
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("geometric_median input must be a one-dimensional array without NULLs")));
+	Assert(ARR_ELEMTYPE(arr) == FLOAT8OID);
+
+	dim = ARR_DIMS(arr)[0];
+	if (state == NULL)
+	{
+		if (dim == 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+					 errmsg("geometric_median input must not be an empty array")));
+		state = geomedian_init(agg_context, dim, geomedian_get_tolerance(fcinfo, 2));
+	}
+	else if (dim != state->dim)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("all arrays passed to geometric_median must have the same number of elements")));
+
+	geomedian_append(state, (const double *) ARR_DATA_PTR(arr));
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Geometric median final function for float8[] coordinates.
+ */
+Datum
+geometric_median_array_finalfn(PG_FUNCTION_ARGS)
+{
+	GeoMedianState *state;
+	double	   *y;
+	Datum	   *elems;
+	int			d;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "geometric_median_array_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (GeoMedianState *) PG_GETARG_POINTER(0);
+	if (state == NULL || state->num_points == 0)
+		PG_RETURN_NULL();
+
+	y = (double *) palloc(state->dim * sizeof(double));
+	geomedian_solve(state, y);
+
+	elems = (Datum *) palloc(state->dim * sizeof(Datum));
+	for (d = 0; d < state->dim; d++)
+		elems[d] = Float8GetDatum(y[d]);
+
+	PG_RETURN_ARRAYTYPE_P(construct_array(elems, state->dim, FLOAT8OID,
+										  sizeof(float8), FLOAT8PASSBYVAL, 'd'));
+}
@@ -0,0 +1,285 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <common/int.h>
+#include <math.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/float.h>
+#include "catalog/pg_type_d.h"
+
+#include "median_compat.h"
+
+/*
+ * Quantiles of pre-bucketed histograms.
+ *
+ * A histogram is given as an array of increasing bucket upper bounds and an
+ * array of counts per bucket, either per bucket or cumulative as in
+ * Prometheus. The quantile is interpolated linearly within the bucket that
+ * holds its rank, following Prometheus' histogram_quantile(): the lowest
+ * bucket starts at 0 (or is returned as its upper bound if that is not
+ * positive), and a rank falling into a last bucket with bound +Infinity
+ * gives the highest finite bound.
+ *
+ * The aggregate sums the counts of histograms with identical bounds across
+ * rows before interpolating. Counts are added as a plain loop over unsigned
+ * arrays that the compiler can vectorize, with overflow detected once per
+ * row from the sign bit of the sums.
+ */
+
+PG_FUNCTION_INFO_V1(histogram_quantile);
+PG_FUNCTION_INFO_V1(histogram_quantile_transfn);
+PG_FUNCTION_INFO_V1(histogram_quantile_finalfn);
+
+typedef struct HistogramState
+{
+	int			nbuckets;
+	double		quantile;
+	bool		cumulative;
+	float8	   *bounds;
+	uint64	   *counts;			/* summed counts, each below 2^63 */
+} HistogramState;
+
+static int	histogram_check(ArrayType *bounds, ArrayType *counts, bool cumulative);
+static double histogram_get_quantile(FunctionCallInfo fcinfo, int argno);
+static double histogram_interpolate(const float8 *bounds, const uint64 *counts,
+									int nbuckets, bool cumulative,
+									double quantile, bool *isnull);
+
+/*
+ * Check that bounds and counts form a valid histogram and return its
+ * number of buckets.
+ */
+static int
+histogram_check(ArrayType *bounds, ArrayType *counts, bool cumulative)
+{
+	const float8 *b;
+	const int64 *c;
+	int			nbuckets;
+	bool		invalid = false;
+	int			i;
+
+	if (ARR_NDIM(bounds) != 1 || array_contains_nulls(bounds) ||
+		ARR_NDIM(counts) != 1 || array_contains_nulls(counts))
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("histogram bounds and counts must be one-dimensional arrays without NULLs")));
+	Assert(ARR_ELEMTYPE(bounds) == FLOAT8OID && ARR_ELEMTYPE(counts) == INT8OID);
+
+	nbuckets = ARR_DIMS(bounds)[0];
+	if (ARR_DIMS(counts)[0] != nbuckets)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("histogram bounds and counts must have the same number of elements")));
+
+	b = (const float8 *) ARR_DATA_PTR(bounds);
+	for (i = 1; i < nbuckets; i++)
+		invalid |= !(b[i - 1] < b[i]);
+	if (invalid)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("histogram bounds must be increasing")));
+
+	c = (const int64 *) ARR_DATA_PTR(counts);
+	for (i = 0; i < nbuckets; i++)
+		invalid |= c[i] < 0;
+	if (cumulative)
+	{
+		for (i = 1; i < nbuckets; i++)
+			invalid |= c[i] < c[i - 1];
+	}
+	if (invalid)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg(cumulative ? "cumulative histogram counts must be non-negative and non-decreasing" :
+						"histogram counts must be non-negative")));
+
+	return nbuckets;
+}
+
+static double
+histogram_get_quantile(FunctionCallInfo fcinfo, int argno)
+{
+	double		quantile = PG_GETARG_FLOAT8(argno);
+
+	if (quantile < 0 || quantile > 1 || isnan(quantile))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("quantile value %g is not between 0 and 1", quantile)));
+	return quantile;
+}
+
+/*
+ * Interpolate the quantile within the bucket holding its rank. Sets isnull
+ * for a histogram without any counts.
+ */
+static double
+histogram_interpolate(const float8 *bounds, const uint64 *counts, int nbuckets,
+					  bool cumulative, double quantile, bool *isnull)
+{
+	uint64		total = 0;
+	uint64		below = 0;
+	uint64		upto = 0;
+	double		rank;
+	double		lower;
+	int			i;
+
+	if (cumulative)
+		total = counts[nbuckets - 1];
+	else
+	{
+		for (i = 0; i < nbuckets; i++)
+		{
+			if (pg_add_u64_overflow(total, counts[i], &total))
+				ereport(ERROR,
+						(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+						 errmsg("sum of histogram counts out of range")));
+		}
+	}
+	*isnull = (total == 0);
+	if (total == 0)
+		return 0;
+
+	/* Find the first non-empty bucket that reaches the rank */
+	rank = quantile * total;
+	for (i = 0; i < nbuckets; i++)
+	{
+		upto = cumulative ? counts[i] : below + counts[i];
+		if (upto > below && upto >= rank)
+			break;
+		below = upto;
+	}
+	Assert(i < nbuckets);
+
+	if (i == nbuckets - 1 && isinf(bounds[i]) && bounds[i] > 0)
+		return i > 0 ? bounds[i - 1] : get_float8_nan();
+	if (i == 0 && bounds[0] <= 0)
+		return bounds[0];
+
+	lower = i > 0 ? bounds[i - 1] : 0;
+	return lower + (bounds[i] - lower) * ((rank - below) / (upto - below));
+}
+
+/*
+ * histogram_quantile(bounds float8[], counts int8[], quantile float8,
+ *					  cumulative bool)
+ */
+Datum
+histogram_quantile(PG_FUNCTION_ARGS)
+{
+	ArrayType  *bounds = PG_GETARG_ARRAYTYPE_P(0);
+	ArrayType  *counts = PG_GETARG_ARRAYTYPE_P(1);
+	double		quantile = histogram_get_quantile(fcinfo, 2);
+	bool		cumulative = PG_GETARG_BOOL(3);
+	int			nbuckets;
+	double		result;
+	bool		isnull;
+
+	nbuckets = histogram_check(bounds, counts, cumulative);
+
+	/* Non-negative int8 counts have the same representation as uint64 */
+	result = histogram_interpolate((const float8 *) ARR_DATA_PTR(bounds),
+								   (const uint64 *) ARR_DATA_PTR(counts),
+								   nbuckets, cumulative, quantile, &isnull);
+	if (isnull)
+		PG_RETURN_NULL();
+	PG_RETURN_FLOAT8(result);
+}
+
+/*
+ * Transition function of histogram_quantile_agg(bounds, counts, quantile
+ * [, cumulative]).
+ *
+ * All histograms must have the same bounds. The quantile and the cumulative
+ * flag are taken from the first row, like the fraction of percentile_disc.
+ * As sums of cumulative counts are the cumulative sums of the counts, the
+ * counts are added up the same way for both kinds.
+ */
+Datum
+histogram_quantile_transfn(PG_FUNCTION_ARGS)
+{
+	HistogramState *state = NULL;
+	MemoryContext agg_context;
+	ArrayType  *bounds;
+	ArrayType  *counts;
+	const uint64 *c;
+	uint64		overflow = 0;
+	int			nbuckets;
+	int			i;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "histogram_quantile_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		state = (HistogramState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		PG_RETURN_POINTER(state);
+
+	bounds = PG_GETARG_ARRAYTYPE_P(1);
+	counts = PG_GETARG_ARRAYTYPE_P(2);
+
+	if (state == NULL)
+	{
+		if (PG_ARGISNULL(3))
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("histogram quantile must not be NULL")));
+
+		state = (HistogramState *) MemoryContextAllocZero(agg_context, sizeof(HistogramState));
+		state->quantile = histogram_get_quantile(fcinfo, 3);
+		state->cumulative = PG_NARGS() > 4 && !PG_ARGISNULL(4) && PG_GETARG_BOOL(4);
+		state->nbuckets = histogram_check(bounds, counts, state->cumulative);
+		state->bounds = (float8 *) MemoryContextAlloc(agg_context,
+													  Max(state->nbuckets, 1) * sizeof(float8));
+		memcpy(state->bounds, ARR_DATA_PTR(bounds), state->nbuckets * sizeof(float8));
+		state->counts = (uint64 *) MemoryContextAllocZero(agg_context,
+														  Max(state->nbuckets, 1) * sizeof(uint64));
+	}
+	else
+	{
+		nbuckets = histogram_check(bounds, counts, state->cumulative);
+		if (nbuckets != state->nbuckets ||
+			memcmp(state->bounds, ARR_DATA_PTR(bounds), nbuckets * sizeof(float8)) != 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("all histograms passed to histogram_quantile_agg must have the same bounds")));
+	}
+
+	/* Both addends are below 2^63, so an overflow shows in the top bit */
+	c = (const uint64 *) ARR_DATA_PTR(counts);
+	for (i = 0; i < state->nbuckets; i++)
+	{
+		state->counts[i] += c[i];
+		overflow |= state->counts[i];
+	}
+	if (overflow >> 63)
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("bigint out of range")));
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Final function of histogram_quantile_agg.
+ */
+Datum
+histogram_quantile_finalfn(PG_FUNCTION_ARGS)
+{
+	HistogramState *state;
+	double		result;
+	bool		isnull;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "histogram_quantile_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (HistogramState *) PG_GETARG_POINTER(0);
+	if (state == NULL)
+		PG_RETURN_NULL();
+
+	result = histogram_interpolate(state->bounds, state->counts, state->nbuckets,
+								   state->cumulative, state->quantile, &isnull);
+	if (isnull)
+		PG_RETURN_NULL();
+	PG_RETURN_FLOAT8(result);
+}
@@ -1,12 +1,37 @@
 CREATE OR REPLACE FUNCTION _median_transfn(state internal, val anyelement)
 RETURNS internal
 AS 'MODULE_PATHNAME', 'median_transfn'
-LANGUAGE C IMMUTABLE;
+LANGUAGE C STABLE PARALLEL SAFE;
 
 CREATE OR REPLACE FUNCTION _median_finalfn(state internal, val anyelement)
 RETURNS anyelement
 AS 'MODULE_PATHNAME', 'median_finalfn'
-LANGUAGE C IMMUTABLE;
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_combinefn(state1 internal, state2 internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_combinefn'
+LANGUAGE C STABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_serialfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'median_serialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_deserialfn(state bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_deserialfn'
+LANGUAGE C STABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_moving_transfn(state internal, val anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_moving_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_moving_invfn(state internal, val anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_moving_invfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
 
 DROP AGGREGATE IF EXISTS median (ANYELEMENT);
 CREATE AGGREGATE median (ANYELEMENT)
@@ -14,5 +39,786 @@ CREATE AGGREGATE median (ANYELEMENT)
     sfunc = _median_transfn,
     stype = internal,
     finalfunc = _median_finalfn,
-    finalfunc_extra
+    finalfunc_extra,
+    combinefunc = _median_combinefn,
+    serialfunc = _median_serialfn,
+    deserialfunc = _median_deserialfn,
+    msfunc = _median_moving_transfn,
+    minvfunc = _median_moving_invfn,
+    mstype = internal,
+    mfinalfunc = _median_finalfn,
+    mfinalfunc_extra,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION _geometric_median_point_transfn(state internal, val point)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'geometric_median_point_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _geometric_median_point_transfn(state internal, val point, tolerance float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'geometric_median_point_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _geometric_median_point_finalfn(state internal)
+RETURNS point
+AS 'MODULE_PATHNAME', 'geometric_median_point_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _geometric_median_array_transfn(state internal, val float8[])
+RETURNS internal
+AS 'MODULE_PATHNAME', 'geometric_median_array_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _geometric_median_array_transfn(state internal, val float8[], tolerance float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'geometric_median_array_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _geometric_median_array_finalfn(state internal)
+RETURNS float8[]
+AS 'MODULE_PATHNAME', 'geometric_median_array_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS geometric_median (point);
+CREATE AGGREGATE geometric_median (point)
+(
+    sfunc = _geometric_median_point_transfn,
+    stype = internal,
+    finalfunc = _geometric_median_point_finalfn,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS geometric_median (point, float8);
+CREATE AGGREGATE geometric_median (point, float8)
+(
+    sfunc = _geometric_median_point_transfn,
+    stype = internal,
+    finalfunc = _geometric_median_point_finalfn,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS geometric_median (float8[]);
+CREATE AGGREGATE geometric_median (float8[])
+(
+    sfunc = _geometric_median_array_transfn,
+    stype = internal,
+    finalfunc = _geometric_median_array_finalfn,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS geometric_median (float8[], float8);
+CREATE AGGREGATE geometric_median (float8[], float8)
+(
+    sfunc = _geometric_median_array_transfn,
+    stype = internal,
+    finalfunc = _geometric_median_array_finalfn,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION _fast_percentile_cont_float8_transfn(state internal, val float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _fast_percentile_cont_interval_transfn(state internal, val interval)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _fast_percentile_disc_finalfn(state internal, fraction float8, val anyelement)
+RETURNS anyelement
+AS 'MODULE_PATHNAME', 'fast_percentile_disc_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _fast_percentile_disc_multi_finalfn(state internal, fractions float8[], val anyelement)
+RETURNS anyarray
+AS 'MODULE_PATHNAME', 'fast_percentile_disc_multi_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _fast_percentile_cont_float8_finalfn(state internal, fraction float8, val float8)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'fast_percentile_cont_float8_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _fast_percentile_cont_float8_multi_finalfn(state internal, fractions float8[], val float8)
+RETURNS float8[]
+AS 'MODULE_PATHNAME', 'fast_percentile_cont_float8_multi_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _fast_percentile_cont_interval_finalfn(state internal, fraction float8, val interval)
+RETURNS interval
+AS 'MODULE_PATHNAME', 'fast_percentile_cont_interval_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _fast_percentile_cont_interval_multi_finalfn(state internal, fractions float8[], val interval)
+RETURNS interval[]
+AS 'MODULE_PATHNAME', 'fast_percentile_cont_interval_multi_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS fast_percentile_disc (float8 ORDER BY anyelement);
+CREATE AGGREGATE fast_percentile_disc (float8 ORDER BY anyelement)
+(
+    sfunc = _median_transfn,
+    stype = internal,
+    finalfunc = _fast_percentile_disc_finalfn,
+    finalfunc_extra,
+    finalfunc_modify = shareable,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS fast_percentile_disc (float8[] ORDER BY anyelement);
+CREATE AGGREGATE fast_percentile_disc (float8[] ORDER BY anyelement)
+(
+    sfunc = _median_transfn,
+    stype = internal,
+    finalfunc = _fast_percentile_disc_multi_finalfn,
+    finalfunc_extra,
+    finalfunc_modify = shareable,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS fast_percentile_cont (float8 ORDER BY float8);
+CREATE AGGREGATE fast_percentile_cont (float8 ORDER BY float8)
+(
+    sfunc = _fast_percentile_cont_float8_transfn,
+    stype = internal,
+    finalfunc = _fast_percentile_cont_float8_finalfn,
+    finalfunc_extra,
+    finalfunc_modify = shareable,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS fast_percentile_cont (float8[] ORDER BY float8);
+CREATE AGGREGATE fast_percentile_cont (float8[] ORDER BY float8)
+(
+    sfunc = _fast_percentile_cont_float8_transfn,
+    stype = internal,
+    finalfunc = _fast_percentile_cont_float8_multi_finalfn,
+    finalfunc_extra,
+    finalfunc_modify = shareable,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS fast_percentile_cont (float8 ORDER BY interval);
+CREATE AGGREGATE fast_percentile_cont (float8 ORDER BY interval)
+(
+    sfunc = _fast_percentile_cont_interval_transfn,
+    stype = internal,
+    finalfunc = _fast_percentile_cont_interval_finalfn,
+    finalfunc_extra,
+    finalfunc_modify = shareable,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS fast_percentile_cont (float8[] ORDER BY interval);
+CREATE AGGREGATE fast_percentile_cont (float8[] ORDER BY interval)
+(
+    sfunc = _fast_percentile_cont_interval_transfn,
+    stype = internal,
+    finalfunc = _fast_percentile_cont_interval_multi_finalfn,
+    finalfunc_extra,
+    finalfunc_modify = shareable,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val int8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val int8, order_key anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_keyed_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val float8, order_key anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_keyed_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val timestamptz)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val timestamptz, order_key anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_keyed_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val timestamp)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_transfn(state internal, val timestamp, order_key anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_delta_keyed_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_counter_delta_transfn(state internal, val int8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_counter_delta_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_counter_delta_transfn(state internal, val int8, order_key anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_counter_delta_keyed_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_counter_delta_transfn(state internal, val float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_counter_delta_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_counter_delta_transfn(state internal, val float8, order_key anyelement)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_counter_delta_keyed_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val int8)
+RETURNS int8
+AS 'MODULE_PATHNAME', 'median_delta_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val int8, order_key anyelement)
+RETURNS int8
+AS 'MODULE_PATHNAME', 'median_delta_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val float8)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'median_delta_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val float8, order_key anyelement)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'median_delta_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val timestamptz)
+RETURNS interval
+AS 'MODULE_PATHNAME', 'median_delta_interval_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val timestamptz, order_key anyelement)
+RETURNS interval
+AS 'MODULE_PATHNAME', 'median_delta_interval_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val timestamp)
+RETURNS interval
+AS 'MODULE_PATHNAME', 'median_delta_interval_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_delta_finalfn(state internal, val timestamp, order_key anyelement)
+RETURNS interval
+AS 'MODULE_PATHNAME', 'median_delta_interval_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS median_delta (int8);
+CREATE AGGREGATE median_delta (int8)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_delta (int8, anyelement);
+CREATE AGGREGATE median_delta (int8, anyelement)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_delta (float8);
+CREATE AGGREGATE median_delta (float8)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_delta (float8, anyelement);
+CREATE AGGREGATE median_delta (float8, anyelement)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_delta (timestamptz);
+CREATE AGGREGATE median_delta (timestamptz)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_delta (timestamptz, anyelement);
+CREATE AGGREGATE median_delta (timestamptz, anyelement)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_delta (timestamp);
+CREATE AGGREGATE median_delta (timestamp)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_delta (timestamp, anyelement);
+CREATE AGGREGATE median_delta (timestamp, anyelement)
+(
+    sfunc = _median_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_counter_delta (int8);
+CREATE AGGREGATE median_counter_delta (int8)
+(
+    sfunc = _median_counter_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_counter_delta (int8, anyelement);
+CREATE AGGREGATE median_counter_delta (int8, anyelement)
+(
+    sfunc = _median_counter_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_counter_delta (float8);
+CREATE AGGREGATE median_counter_delta (float8)
+(
+    sfunc = _median_counter_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS median_counter_delta (float8, anyelement);
+CREATE AGGREGATE median_counter_delta (float8, anyelement)
+(
+    sfunc = _median_counter_delta_transfn,
+    stype = internal,
+    finalfunc = _median_delta_finalfn,
+    finalfunc_extra,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION histogram_quantile(bounds float8[], counts int8[], quantile float8, cumulative boolean DEFAULT false)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'histogram_quantile'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _histogram_quantile_transfn(state internal, bounds float8[], counts int8[], quantile float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'histogram_quantile_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _histogram_quantile_transfn(state internal, bounds float8[], counts int8[], quantile float8, cumulative boolean)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'histogram_quantile_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _histogram_quantile_finalfn(state internal)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'histogram_quantile_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS histogram_quantile_agg (float8[], int8[], float8);
+CREATE AGGREGATE histogram_quantile_agg (float8[], int8[], float8)
+(
+    sfunc = _histogram_quantile_transfn,
+    stype = internal,
+    finalfunc = _histogram_quantile_finalfn,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS histogram_quantile_agg (float8[], int8[], float8, boolean);
+CREATE AGGREGATE histogram_quantile_agg (float8[], int8[], float8, boolean)
+(
+    sfunc = _histogram_quantile_transfn,
+    stype = internal,
+    finalfunc = _histogram_quantile_finalfn,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION _decayed_median_transfn(state internal, ts timestamptz, val float8, half_life interval)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'decayed_median_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _decayed_median_finalfn(state internal)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'decayed_median_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _decayed_median_combinefn(state1 internal, state2 internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'decayed_median_combinefn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _decayed_median_serialfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'decayed_median_serialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _decayed_median_deserialfn(state bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'decayed_median_deserialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS decayed_median (timestamptz, float8, interval);
+CREATE AGGREGATE decayed_median (timestamptz, float8, interval)
+(
+    sfunc = _decayed_median_transfn,
+    stype = internal,
+    finalfunc = _decayed_median_finalfn,
+    combinefunc = _decayed_median_combinefn,
+    serialfunc = _decayed_median_serialfn,
+    deserialfunc = _decayed_median_deserialfn,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION _quantile_sketch_transfn(state internal, val float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'quantile_sketch_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _quantile_sketch_merge_transfn(state internal, sketch bytea)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'quantile_sketch_merge_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _quantile_sketch_finalfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'quantile_sketch_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _quantile_sketch_combinefn(state1 internal, state2 internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'quantile_sketch_combinefn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _quantile_sketch_serialfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'quantile_sketch_serialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _quantile_sketch_deserialfn(state bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'quantile_sketch_deserialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS quantile_sketch (float8);
+CREATE AGGREGATE quantile_sketch (float8)
+(
+    sfunc = _quantile_sketch_transfn,
+    stype = internal,
+    finalfunc = _quantile_sketch_finalfn,
+    combinefunc = _quantile_sketch_combinefn,
+    serialfunc = _quantile_sketch_serialfn,
+    deserialfunc = _quantile_sketch_deserialfn,
+    parallel = safe
+);
+
+DROP AGGREGATE IF EXISTS quantile_sketch_merge (bytea);
+CREATE AGGREGATE quantile_sketch_merge (bytea)
+(
+    sfunc = _quantile_sketch_merge_transfn,
+    stype = internal,
+    finalfunc = _quantile_sketch_finalfn,
+    combinefunc = _quantile_sketch_combinefn,
+    serialfunc = _quantile_sketch_serialfn,
+    deserialfunc = _quantile_sketch_deserialfn,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION quantile_sketch_combine(sketch1 bytea, sketch2 bytea)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'quantile_sketch_combine'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION quantile_sketch_quantile(sketch bytea, quantile float8)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'quantile_sketch_get_quantile'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE TABLE median_rollup_config (
+    id serial PRIMARY KEY,
+    relid regclass NOT NULL,
+    ts_column name NOT NULL,
+    val_column name NOT NULL,
+    bucket_width interval NOT NULL,
+    watermark timestamptz,
+    owner regrole NOT NULL,
+    UNIQUE (relid, val_column)
+);
+
+CREATE TABLE median_rollup_data (
+    rollup_id int NOT NULL REFERENCES median_rollup_config (id) ON DELETE CASCADE,
+    bucket timestamptz NOT NULL,
+    sketch bytea NOT NULL,
+    PRIMARY KEY (rollup_id, bucket)
+);
+
+SELECT pg_catalog.pg_extension_config_dump('median_rollup_config', '');
+SELECT pg_catalog.pg_extension_config_dump('median_rollup_config_id_seq', '');
+SELECT pg_catalog.pg_extension_config_dump('median_rollup_data', '');
+
+-- median_rollup_add() is the only way to register a rollup, so that its
+-- owner is a role that could read the table
+REVOKE ALL ON median_rollup_config, median_rollup_config_id_seq FROM PUBLIC;
+
+CREATE OR REPLACE FUNCTION median_rollup_add(relation regclass, ts_column name, val_column name, bucket_width interval)
+RETURNS int
+AS 'MODULE_PATHNAME', 'median_rollup_add'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION median_rollup_refresh()
+RETURNS int8
+AS 'MODULE_PATHNAME', 'median_rollup_refresh'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION median_rollup_remove(relation regclass, val_column name)
+RETURNS boolean
+AS $$
+    WITH removed AS (
+        DELETE FROM @extschema@.median_rollup_config c
+        WHERE c.relid = $1 AND c.val_column = $2
+        RETURNING 1
+    )
+    SELECT count(*) > 0 FROM removed
+$$ LANGUAGE SQL STRICT;
+
+CREATE OR REPLACE FUNCTION _median_rollup_check_select(relation regclass)
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'median_rollup_check_select'
+LANGUAGE C STABLE STRICT;
+
+CREATE OR REPLACE FUNCTION median_rollup_quantile(relation regclass, val_column name, quantile float8, from_ts timestamptz, to_ts timestamptz)
+RETURNS float8
+AS $$
+    SELECT @extschema@.quantile_sketch_quantile(@extschema@.quantile_sketch_merge(d.sketch), $3)
+    FROM @extschema@.median_rollup_data d
+    JOIN @extschema@.median_rollup_config c ON c.id = d.rollup_id
+    WHERE @extschema@._median_rollup_check_select($1)
+      AND c.relid = $1 AND c.val_column = $2 AND d.bucket >= $4 AND d.bucket < $5
+$$ LANGUAGE SQL STABLE STRICT;
+
+CREATE OR REPLACE FUNCTION median_rollup_median(relation regclass, val_column name, from_ts timestamptz, to_ts timestamptz)
+RETURNS float8
+AS $$
+    SELECT @extschema@.median_rollup_quantile($1, $2, 0.5, $3, $4)
+$$ LANGUAGE SQL STABLE STRICT;
+
+CREATE OR REPLACE FUNCTION _medians_transfn(state internal, vals anyarray)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'medians_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _medians_finalfn(state internal, vals anyarray)
+RETURNS anyarray
+AS 'MODULE_PATHNAME', 'medians_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _medians_combinefn(state1 internal, state2 internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'medians_combinefn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _medians_serialfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'medians_serialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _medians_deserialfn(state bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'medians_deserialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS medians (VARIADIC anyarray);
+CREATE AGGREGATE medians (VARIADIC anyarray)
+(
+    sfunc = _medians_transfn,
+    stype = internal,
+    finalfunc = _medians_finalfn,
+    finalfunc_extra,
+    combinefunc = _medians_combinefn,
+    serialfunc = _medians_serialfn,
+    deserialfunc = _medians_deserialfn,
+    parallel = safe
+);
+
+CREATE TYPE median_confidence_interval AS (lower float8, median float8, upper float8);
+
+CREATE OR REPLACE FUNCTION _median_ci_transfn(state internal, val float8, confidence float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_ci_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_ci_finalfn(state internal)
+RETURNS median_confidence_interval
+AS 'MODULE_PATHNAME', 'median_ci_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_ci_combinefn(state1 internal, state2 internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_ci_combinefn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_ci_serialfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'median_ci_serialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_ci_deserialfn(state bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_ci_deserialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS median_ci (float8, float8);
+CREATE AGGREGATE median_ci (float8, float8)
+(
+    sfunc = _median_ci_transfn,
+    stype = internal,
+    finalfunc = _median_ci_finalfn,
+    combinefunc = _median_ci_combinefn,
+    serialfunc = _median_ci_serialfn,
+    deserialfunc = _median_ci_deserialfn,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION median_from_file(path text, column_index int, format text DEFAULT 'csv', header boolean DEFAULT false)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'median_from_file'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION median_from_file(path text, column_index int, format text, type anyelement, header boolean DEFAULT false)
+RETURNS anyelement
+AS 'MODULE_PATHNAME', 'median_from_file_typed'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION median_of(VARIADIC anyarray)
+RETURNS anyelement
+AS 'MODULE_PATHNAME', 'median_of'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fast_percent_rank(val anyelement)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'fast_percent_rank'
+LANGUAGE C WINDOW IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION fast_ntile(val anyelement, buckets int)
+RETURNS int
+AS 'MODULE_PATHNAME', 'fast_ntile'
+LANGUAGE C WINDOW IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION median_coalesced(relation regclass, val_column name, filter text DEFAULT NULL)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'median_coalesced'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION _median_compress_transfn(state internal, ts timestamptz, val float8)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_compress_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_compress_finalfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'median_compress_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS median_compress (timestamptz, float8);
+CREATE AGGREGATE median_compress (timestamptz, float8)
+(
+    sfunc = _median_compress_transfn,
+    stype = internal,
+    finalfunc = _median_compress_finalfn,
+    parallel = safe
+);
+
+CREATE OR REPLACE FUNCTION median_compressed(segment bytea)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'median_compressed'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION median_decompress(segment bytea)
+RETURNS TABLE (ts timestamptz, val float8)
+AS 'MODULE_PATHNAME', 'median_decompress'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_compressed_transfn(state internal, segment bytea)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_compressed_transfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_compressed_finalfn(state internal)
+RETURNS float8
+AS 'MODULE_PATHNAME', 'median_compressed_finalfn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_compressed_combinefn(state1 internal, state2 internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_compressed_combinefn'
+LANGUAGE C IMMUTABLE PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_compressed_serialfn(state internal)
+RETURNS bytea
+AS 'MODULE_PATHNAME', 'median_compressed_serialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION _median_compressed_deserialfn(state bytea, internal)
+RETURNS internal
+AS 'MODULE_PATHNAME', 'median_compressed_deserialfn'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+DROP AGGREGATE IF EXISTS median_compressed_agg (bytea);
+CREATE AGGREGATE median_compressed_agg (bytea)
+(
+    sfunc = _median_compressed_transfn,
+    stype = internal,
+    finalfunc = _median_compressed_finalfn,
+    combinefunc = _median_compressed_combinefn,
+    serialfunc = _median_compressed_serialfn,
+    deserialfunc = _median_compressed_deserialfn,
+    parallel = safe
 );
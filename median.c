@@ -1,40 +1,58 @@
 #include <postgres.h>
 #include <fmgr.h>
+#include <miscadmin.h>
+#include <libpq/pqformat.h>
+#include <nodes/execnodes.h>
+#include <nodes/parsenodes.h>
+#include <nodes/plannodes.h>
 #include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/guc.h>
+#include <utils/typcache.h>
+#include "catalog/pg_aggregate_d.h"
 #include "catalog/pg_type_d.h"
 
-#if PG_VERSION_NUM < 120000 || PG_VERSION_NUM >= 130000
-#error "Unsupported PostgreSQL version. Use version 12."
-#endif
+#include "median.h"
 
 #ifdef PG_MODULE_MAGIC
 PG_MODULE_MAGIC;
 #endif
 
+void		_PG_init(void);
+
+/*
+ * Limit for presizing the value buffer from the planner's estimates. Only
+ * a few groups are presized, each to at most work_mem; larger or more groups
+ * grow their buffers as needed.
+ */
+#define MEDIAN_PRESIZE_MAX_GROUPS	64
+
 PG_FUNCTION_INFO_V1(median_transfn);
+PG_FUNCTION_INFO_V1(median_finalfn);
+PG_FUNCTION_INFO_V1(median_combinefn);
+PG_FUNCTION_INFO_V1(median_serialfn);
+PG_FUNCTION_INFO_V1(median_deserialfn);
+PG_FUNCTION_INFO_V1(median_moving_transfn);
+PG_FUNCTION_INFO_V1(median_moving_invfn);
+
+static Datum median_transfn_common(FunctionCallInfo fcinfo, bool moving);
+static int64 median_estimate_group_size(FunctionCallInfo fcinfo);
+static MedianBuffer *median_group_buffer(FunctionCallInfo fcinfo);
+static MedianInputOrder median_input_order(FunctionCallInfo fcinfo, Oid typid);
 
-/* The DS to store internal state 
- * which is a sorted list and number
- * of values
+/*
+ * Module initialization: define the settings of the extension and, when
+ * preloaded, register its background worker and shared memory.
  */
-typedef struct SortMemoryState {
-	Datum vals;
-	int num_vals;
-}SortMemoryState;
-
-/* Linked list for sorted values */
-typedef struct SortVals {
-	Datum val;
-	struct SortVals *next;		
-}SortVals;
-
-/* Datatype specific routines for comparison of values*/
-SortVals *int8_cmp(int64 newval, SortVals **new_val_node, SortVals *sort_vals_head);
-SortVals *float4_cmp(float newval, SortVals **new_val_node, SortVals *sort_vals_head);
-SortVals *int4_cmp(int32 newval, SortVals **new_val_node, SortVals *sort_vals_head);
-SortVals *int2_cmp(int16 newval, SortVals **new_val_node, SortVals *sort_vals_head);
-SortVals *float8_cmp(double newval, SortVals **new_val_node, SortVals *sort_vals_head);
-SortVals *string_cmp(char *newval, SortVals **new_val_node, SortVals *sort_vals_head);
+void
+_PG_init(void)
+{
+	median_approx_init();
+	median_rollup_init();
+	median_coalesce_init();
+
+	MarkGUCPrefixReserved("median");
+}
 
 /*
  * Median state transfer function.
@@ -46,374 +64,384 @@ SortVals *string_cmp(char *newval, SortVals **new_val_node, SortVals *sort_vals_
 Datum
 median_transfn(PG_FUNCTION_ARGS)
 {
-    SortMemoryState *state;
-    SortVals *sort_vals_head = NULL;
-    SortVals *new_val_node;
-    Oid argtype;
-    int64 newval;
-    double newval_num;
-    char *newval_str;
-
-    MemoryContext agg_context;
-    
-    if (!AggCheckCallContext(fcinfo, &agg_context))
-        elog(ERROR, "median_transfn called in non-aggregate context");
-    if (!PG_ARGISNULL(0))
-    {
-		state = (SortMemoryState *) PG_GETARG_POINTER(0);
-    		sort_vals_head = (SortVals *)DatumGetPointer(state->vals);
-    }
-    /* Initialize the internal state */ 
-    else
-    {
-		state = (SortMemoryState *) MemoryContextAlloc(agg_context, sizeof(SortMemoryState));
-	        state->vals = PointerGetDatum(NULL);
-		state->num_vals = 0;
-    }
-    if (!PG_ARGISNULL(1))
-    {	
-		/* First value*/
-   		if (sort_vals_head == NULL)
-    		{
-    			sort_vals_head = (SortVals *) MemoryContextAlloc(agg_context, sizeof(SortVals));
-    			sort_vals_head->next = NULL;
-			sort_vals_head->val = PG_GETARG_DATUM(1);
-
-			state->num_vals = 1;
-			state->vals  = PointerGetDatum(sort_vals_head);
-			PG_RETURN_POINTER(state);	
-    		}
-    		new_val_node = (SortVals *) MemoryContextAlloc(agg_context, sizeof(SortVals));
-    		new_val_node->next = NULL;
-    		new_val_node->val = PG_GETARG_DATUM(1);
-
-		/*
-		 * Call the routines to insert new value into the correct position in
-		 * a sorted array
-		 */
-		argtype = get_fn_expr_argtype(fcinfo->flinfo, 1);
-		switch (argtype)
-		{
-			case TIMESTAMPTZOID:
-			case INT8OID:
-				 newval = PG_GETARG_INT64(1);
-				 sort_vals_head = int8_cmp(newval, &new_val_node, sort_vals_head);
-				break;
-			case INT4OID:
-				 newval = PG_GETARG_INT32(1);
-				 sort_vals_head = int4_cmp(newval, &new_val_node, sort_vals_head);
-				 break;
-			case INT2OID:
-				 newval = PG_GETARG_INT16(1);
-	 			 sort_vals_head = int2_cmp(newval, &new_val_node, sort_vals_head);
-				break;
-			case FLOAT4OID:
-				newval_num = PG_GETARG_FLOAT4(1);	
-	 			 sort_vals_head = float4_cmp(newval_num, &new_val_node, sort_vals_head);
-				break;
-			case FLOAT8OID:
-				newval_num = PG_GETARG_FLOAT8(1);	
-	 			 sort_vals_head = float8_cmp(newval_num, &new_val_node, sort_vals_head);
-				break;
-			case TEXTOID:
-				newval_str = text_to_cstring(PG_GETARG_TEXT_PP(1));
-	 			 sort_vals_head = string_cmp(newval_str, &new_val_node, sort_vals_head);
-				break;
-		}
-    }
-    /* We ignore the NULLs */
-    else 
-	PG_RETURN_POINTER(state); 
-    /* Set the internal state for this iteration */
-    state->vals  = PointerGetDatum(sort_vals_head);
-    state->num_vals++;
-    PG_RETURN_POINTER(state);
+	return median_transfn_common(fcinfo, false);
 }
 
 /*
- * This is called by transition function to insert an integer value in
- * a sorted list
+ * Median state transfer function for moving window frames, whose values may
+ * be removed again by median_moving_invfn.
  */
-SortVals *
-int8_cmp(int64 newval, SortVals **new_val_node, SortVals *sort_vals_head)
+Datum
+median_moving_transfn(PG_FUNCTION_ARGS)
 {
-    SortVals *sort_vals = sort_vals_head;
-    SortVals *sort_vals_prev = NULL; 
-    int64 currval;
-    int inserted = false; 
-
-    while(sort_vals != NULL)
-    {
-	currval = DatumGetInt64(sort_vals->val);
-        if (currval <= newval)
+	return median_transfn_common(fcinfo, true);
+}
+
+static Datum
+median_transfn_common(FunctionCallInfo fcinfo, bool moving)
+{
+	MedianState *state;
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_transfn called in non-aggregate context");
+
+	/* Initialize the internal state */
+	if (PG_ARGISNULL(0))
 	{
-		sort_vals_prev = sort_vals;
-		sort_vals = sort_vals->next;
+		int64		group_size;
+		MedianBuffer *buffer;
+
+		Oid			typid = get_fn_expr_argtype(fcinfo->flinfo, 1);
+
+		state = median_state_create(agg_context, typid, PG_GET_COLLATION(),
+									moving, median_agg_hashed(fcinfo));
+		if (!moving)
+		{
+			Aggref	   *aggref = AggGetAggref(fcinfo);
+
+			state->input_order = median_input_order(fcinfo, typid);
+			if ((buffer = median_group_buffer(fcinfo)) != NULL)
+				median_state_use_buffer(state, buffer);
+
+			/* The percentiles sharing this function need exact ranks */
+			if (aggref != NULL && aggref->aggkind == AGGKIND_NORMAL &&
+				state->input_order == MEDIAN_INPUT_UNORDERED)
+				median_approx_setup(state);
+		}
+
+		/*
+		 * Sorted input keeps only about half of the values, and approximation
+		 * no more than the threshold.
+		 */
+		group_size = median_estimate_group_size(fcinfo);
+		if (state->input_order != MEDIAN_INPUT_UNORDERED)
+			group_size = group_size / 2 + 1;
+		if (state->approximate)
+			group_size = Min(group_size, state->approximate_threshold);
+		if (group_size > 0)
+			median_state_grow(state, Min(group_size,
+										 (Size) work_mem * 1024 / state->kernel->elem_size));
 	}
 	else
+		state = (MedianState *) PG_GETARG_POINTER(0);
+
+	/* We ignore the NULLs */
+	if (!PG_ARGISNULL(1))
 	{
-		if (sort_vals == sort_vals_head)
+		if (state->sketch != NULL)
+			median_approx_add(state, PG_GETARG_DATUM(1));
+		else if (state->input_order == MEDIAN_INPUT_UNORDERED)
 		{
-			(*new_val_node)->next = sort_vals_head;
-			sort_vals_head = *new_val_node;
+			state->kernel->ingest(state, PG_GETARG_DATUM(1));
+			if (state->approximate && state->num_vals > state->approximate_threshold)
+				median_approx_start(state);
 		}
 		else
-		{
-			sort_vals_prev->next = *new_val_node;
-			(*new_val_node)->next = sort_vals;	
-		}
-		inserted = true;
-		break;
-    	}
-	if (!inserted && sort_vals == NULL)
-		sort_vals_prev->next = *new_val_node;
-    }
-    return sort_vals_head;
+			median_state_push_sorted(state, PG_GETARG_DATUM(1));
+	}
+
+	PG_RETURN_POINTER(state);
 }
 
 /*
- * This is called by transition function to insert an 
- * 32-bit integer value in a sorted list
+ * Estimate the number of values per group from the plan of the calling Agg
+ * node, for presizing the value buffer. Returns 0 if the buffer should not
+ * be presized.
+ *
+ * With hashing, many states are alive at once and oversized buffers would
+ * push the hash table into spilling, so only plain and sorted aggregation
+ * with few groups qualify. A FILTER clause can pass any fraction of the rows,
+ * so filtered aggregates are not presized either. Should the estimate be too
+ * low, the buffer simply keeps growing from there.
  */
-SortVals *
-int4_cmp(int32 newval, SortVals **new_val_node, SortVals *sort_vals_head)
+static int64
+median_estimate_group_size(FunctionCallInfo fcinfo)
 {
-    SortVals *sort_vals = sort_vals_head;
-    SortVals *sort_vals_prev = NULL; 
-    int32 currval;
-    int inserted = false;		 	
-    
-    while(sort_vals != NULL)
-    {
-	currval = DatumGetInt32(sort_vals->val);
-	/*
-	 * loop until the current value is not greater
-	 * than new value
-	 */
-        if (currval <= newval)
-	{
-		sort_vals_prev = sort_vals;
-		sort_vals = sort_vals->next;
-	}
-	else
-	{
-		/* Insert in the first position */
-		if (sort_vals == sort_vals_head)
-		{
-			(*new_val_node)->next = sort_vals_head;
-			sort_vals_head = *new_val_node;
-		}
-		/* Insert in the middle */
-		else
-		{
-			sort_vals_prev->next = *new_val_node;
-			(*new_val_node)->next = sort_vals;	
-		}
-		inserted = true;
-		break;
-    	}
-	/* Insert in the end */
-	if (!inserted && sort_vals == NULL)
-		sort_vals_prev->next = *new_val_node;
-    }
-    return sort_vals_head;
+	AggState   *aggstate;
+	Aggref	   *aggref;
+	Agg		   *agg;
+	Plan	   *input;
+
+	if (fcinfo->context == NULL || !IsA(fcinfo->context, AggState))
+		return 0;
+
+	aggref = AggGetAggref(fcinfo);
+	if (aggref == NULL || aggref->aggfilter != NULL)
+		return 0;
+
+	aggstate = (AggState *) fcinfo->context;
+	if (aggstate->aggstrategy != AGG_PLAIN && aggstate->aggstrategy != AGG_SORTED)
+		return 0;
+
+	agg = (Agg *) aggstate->ss.ps.plan;
+	input = outerPlan(agg);
+	if (input == NULL || agg->numGroups <= 0 ||
+		agg->numGroups > MEDIAN_PRESIZE_MAX_GROUPS)
+		return 0;
+
+	return (int64) (input->plan_rows / agg->numGroups);
 }
 
 /*
- * This is called by transition function to insert a 
- * 16-bit integer value in a sorted list
+ * Return the value buffer kept across groups in fn_extra, if the calling Agg
+ * node processes one group at a time.
+ *
+ * That holds for sorted and plain aggregation without grouping sets: the
+ * state of a group is done with (finalized, serialized or combined) before
+ * the aggregate context is reset for the next one. Hashed aggregation,
+ * grouping sets and window aggregates keep several states alive at once and
+ * allocate their buffers per state as usual.
  */
-SortVals *
-int2_cmp(int16 newval, SortVals **new_val_node, SortVals *sort_vals_head)
+static MedianBuffer *
+median_group_buffer(FunctionCallInfo fcinfo)
 {
-    SortVals *sort_vals = sort_vals_head;
-    SortVals *sort_vals_prev = NULL; 
-    int16 currval;
-    int inserted = false;		 	
-
-    while(sort_vals != NULL)
-    {
-	currval = DatumGetInt16(sort_vals->val);
-        if (currval <= newval)
+	AggState   *aggstate;
+	MedianBuffer *buffer;
+
+	if (fcinfo->context == NULL || !IsA(fcinfo->context, AggState))
+		return NULL;
+
+	aggstate = (AggState *) fcinfo->context;
+	if ((aggstate->aggstrategy != AGG_PLAIN && aggstate->aggstrategy != AGG_SORTED) ||
+		aggstate->maxsets > 1)
+		return NULL;
+
+	buffer = (MedianBuffer *) fcinfo->flinfo->fn_extra;
+	if (buffer == NULL)
 	{
-		sort_vals_prev = sort_vals;
-		sort_vals = sort_vals->next;
+		buffer = (MedianBuffer *) MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+														 sizeof(MedianBuffer));
+		buffer->context = fcinfo->flinfo->fn_mcxt;
+		fcinfo->flinfo->fn_extra = buffer;
 	}
-	else
-	{
-		if (sort_vals == sort_vals_head)
-		{
-			(*new_val_node)->next = sort_vals_head;
-			sort_vals_head = *new_val_node;
-		}
-		else
-		{
-			sort_vals_prev->next = *new_val_node;
-			(*new_val_node)->next = sort_vals;	
-		}
-		inserted = true;
-		break;
-    	}
-	if (!inserted && sort_vals == NULL)
-		sort_vals_prev->next = *new_val_node;
-    }
-    return sort_vals_head;
+	return buffer;
 }
 
 /*
- * This is called by transition function to insert a 
- * double value in a sorted list
+ * Find out whether the executor feeds us sorted input, which is the case for
+ * median(x ORDER BY x) and median(x ORDER BY x DESC). The sort operator must
+ * be the type's default ordering, which is the one the kernels use.
+ *
+ * Aggregates with ORDER BY are never split into partial aggregates, so such
+ * states are never combined or serialized. Ordered-set aggregates sharing
+ * the transition function get their input unsorted.
  */
-SortVals *
-float8_cmp(double newval, SortVals **new_val_node, SortVals *sort_vals_head)
+static MedianInputOrder
+median_input_order(FunctionCallInfo fcinfo, Oid typid)
 {
-    SortVals *sort_vals = sort_vals_head;
-    SortVals *sort_vals_prev = NULL; 
-    double currval;
-  int inserted = false;		 	
-
-    while(sort_vals != NULL)
-    {
-	currval = DatumGetFloat8(sort_vals->val);
-        if (currval <= newval)
+	Aggref	   *aggref = AggGetAggref(fcinfo);
+	TargetEntry *arg;
+	SortGroupClause *sortcl;
+	TypeCacheEntry *typentry;
+
+	if (aggref == NULL || aggref->aggkind != AGGKIND_NORMAL ||
+		list_length(aggref->aggorder) != 1)
+		return MEDIAN_INPUT_UNORDERED;
+
+	arg = (TargetEntry *) linitial(aggref->args);
+	sortcl = (SortGroupClause *) linitial(aggref->aggorder);
+	if (arg->ressortgroupref == 0 || sortcl->tleSortGroupRef != arg->ressortgroupref)
+		return MEDIAN_INPUT_UNORDERED;
+
+	typentry = lookup_type_cache(typid, TYPECACHE_LT_OPR | TYPECACHE_GT_OPR);
+	if (sortcl->sortop == typentry->lt_opr)
+		return MEDIAN_INPUT_ASCENDING;
+	if (sortcl->sortop == typentry->gt_opr)
+		return MEDIAN_INPUT_DESCENDING;
+	return MEDIAN_INPUT_UNORDERED;
+}
+
+/*
+ * Median inverse transition function.
+ *
+ * Removes a value that left a moving window frame. Returning NULL makes the
+ * executor restart the aggregation for the frame, which is the safe answer
+ * should the value not be found.
+ */
+Datum
+median_moving_invfn(PG_FUNCTION_ARGS)
+{
+	MedianState *state;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_moving_invfn called in non-aggregate context");
+
+	state = (MedianState *) PG_GETARG_POINTER(0);
+	if (!PG_ARGISNULL(1) && !state->kernel->remove(state, PG_GETARG_DATUM(1)))
+		PG_RETURN_NULL();
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Median combine function, for partial and parallel aggregation.
+ *
+ * Appends the values of the second state to the first one, or adds them to
+ * its sketch when either has one.
+ */
+Datum
+median_combinefn(PG_FUNCTION_ARGS)
+{
+	MedianState *state1;
+	MedianState *state2;
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_combinefn called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (MedianState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (MedianState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
 	{
-		sort_vals_prev = sort_vals;
-		sort_vals = sort_vals->next;
+		if (state1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
 	}
+
+	/* The second state may live elsewhere, so always copy its values */
+	if (state1 == NULL)
+	{
+		state1 = median_state_create(agg_context, state2->typid,
+									 state2->collation, false,
+									 median_agg_hashed(fcinfo));
+		median_approx_setup(state1);
+	}
+
+	Assert(state1->input_order == MEDIAN_INPUT_UNORDERED &&
+		   state2->input_order == MEDIAN_INPUT_UNORDERED);
+
+	if (state1->sketch != NULL || state2->sketch != NULL)
+		median_approx_merge(state1, state2);
 	else
 	{
-		if (sort_vals == sort_vals_head)
-		{
-			(*new_val_node)->next = sort_vals_head;
-			sort_vals_head = *new_val_node;
-		}
-		else
-		{
-			sort_vals_prev->next = *new_val_node;
-			(*new_val_node)->next = sort_vals;	
-		}
-		inserted = true;
-		break;
-    	}
-	if (!inserted && sort_vals == NULL)
-		sort_vals_prev->next = *new_val_node;
-    }
-    return sort_vals_head;
+		state1->kernel->merge(state1, state2);
+		if (state1->approximate && state1->num_vals > state1->approximate_threshold)
+			median_approx_start(state1);
+	}
+
+	PG_RETURN_POINTER(state1);
 }
 
 /*
- * This is called by transition function to insert a 
- * float value in a sorted list.
+ * Median serialization function.
+ *
+ * The type and collation go along with the values, as the deserialization
+ * function has no other way of knowing them. A state with a sketch has -1 in
+ * place of the number of values, followed by the sketch.
  */
-SortVals *
-float4_cmp(float newval, SortVals **new_val_node, SortVals *sort_vals_head)
+Datum
+median_serialfn(PG_FUNCTION_ARGS)
 {
-    SortVals *sort_vals = sort_vals_head;
-    SortVals *sort_vals_prev = NULL; 
-    float currval;
-    int inserted = false;		 	
-
-    while(sort_vals != NULL)
-    {
-	currval = DatumGetFloat4(sort_vals->val);
-        if (currval <= newval)
+	MedianState *state;
+	StringInfoData buf;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_serialfn called in non-aggregate context");
+
+	state = (MedianState *) PG_GETARG_POINTER(0);
+
+	pq_begintypsend(&buf);
+	pq_sendint32(&buf, state->typid);
+	pq_sendint32(&buf, state->collation);
+	if (state->sketch != NULL)
 	{
-		sort_vals_prev = sort_vals;
-		sort_vals = sort_vals->next;
+		pq_sendint64(&buf, -1);
+		median_approx_serialize(state, &buf);
 	}
 	else
 	{
-		if (sort_vals == sort_vals_head)
-		{
-			(*new_val_node)->next = sort_vals_head;
-			sort_vals_head = *new_val_node;
-		}
-		else
-		{
-			sort_vals_prev->next = *new_val_node;
-			(*new_val_node)->next = sort_vals;	
-		}
-		inserted = true;
-		break;
-    	}
-	if (!inserted && sort_vals == NULL)
-		sort_vals_prev->next = *new_val_node;
-    }
-    return sort_vals_head;
+		pq_sendint64(&buf, state->num_vals);
+		state->kernel->serialize(state, &buf);
+	}
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
 }
 
 /*
- * This is called by transition function to insert a 
- * text value in a sorted list.
+ * Median deserialization function.
  */
-SortVals *
-string_cmp(char *newval, SortVals **new_val_node, SortVals *sort_vals_head)
+Datum
+median_deserialfn(PG_FUNCTION_ARGS)
 {
-    SortVals *sort_vals = sort_vals_head;
-    SortVals *sort_vals_prev = NULL; 
-    char *currval;
-    int inserted = false;		 	
-
-    while(sort_vals != NULL)
-    {
-	currval = text_to_cstring(DatumGetTextPP(sort_vals->val));
-        if (strcmp(currval,newval) <= 0)
-	{
-		sort_vals_prev = sort_vals;
-		sort_vals = sort_vals->next;
-	}
+	bytea	   *sstate;
+	MedianState *state;
+	MemoryContext agg_context;
+	StringInfoData buf;
+	Oid			typid;
+	Oid			collation;
+	int64		num_vals;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_deserialfn called in non-aggregate context");
+
+	sstate = PG_GETARG_BYTEA_PP(0);
+
+	buf.data = VARDATA_ANY(sstate);
+	buf.len = VARSIZE_ANY_EXHDR(sstate);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+
+	typid = pq_getmsgint(&buf, 4);
+	collation = pq_getmsgint(&buf, 4);
+	num_vals = pq_getmsgint64(&buf);
+
+	state = median_state_create(agg_context, typid, collation, false,
+								median_agg_hashed(fcinfo));
+	if (num_vals < 0)
+		median_approx_deserialize(state, &buf);
 	else
 	{
-		if (sort_vals == sort_vals_head)
-		{
-			(*new_val_node)->next = sort_vals_head;
-			sort_vals_head = *new_val_node;
-		}
-		else
-		{
-			sort_vals_prev->next = *new_val_node;
-			(*new_val_node)->next = sort_vals;	
-		}
-		inserted = true;
-		break;
-    	}
-	if (!inserted && sort_vals == NULL)
-		sort_vals_prev->next = *new_val_node;
-    }
-    return sort_vals_head;
-}
-PG_FUNCTION_INFO_V1(median_finalfn);
+		state->kernel->deserialize(state, &buf, num_vals);
+		median_approx_setup(state);
+	}
+	pq_getmsgend(&buf);
 
+	PG_RETURN_POINTER(state);
+}
 
 /*
  * Median final function.
  *
  * This function is called after all values in the median set has been
- * processed by the state transfer function. It should perform any necessary
- * post processing and clean up any temporary state.
+ * processed by the state transfer function. It selects the value in the
+ * middle of the set, the upper one of the two for an even number of values.
+ *
+ * Selection only reorders the buffer, so the state stays valid for further
+ * calls, as happens with window aggregates.
  */
 Datum
 median_finalfn(PG_FUNCTION_ARGS)
 {
-    MemoryContext agg_context;
-    SortMemoryState *state;
-    SortVals *sort_vals;
-    int median_index, i;
-
-    if (!AggCheckCallContext(fcinfo, &agg_context))
-        elog(ERROR, "median_finalfn called in non-aggregate context");
-     
-     state = PG_ARGISNULL(0) ? NULL : (SortMemoryState *) PG_GETARG_POINTER(0);
-     if (state == NULL)
-	PG_RETURN_NULL();
-     median_index = (int)  (state->num_vals/2);
-
-     elog(LOG, "median_index : %d", median_index);
-     elog(LOG, "state_vals : %d", state->num_vals);
-     sort_vals = (SortVals *)DatumGetPointer(state->vals);
-
-     for(i = 0; i < median_index; i++)
-     	sort_vals = sort_vals->next;
-
-     PG_RETURN_DATUM(sort_vals->val);
+	MedianState *state;
+	Datum		result;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (MedianState *) PG_GETARG_POINTER(0);
+	if (state != NULL && state->sketch != NULL)
+	{
+		bool		isnull;
+
+		result = median_approx_result(state, &isnull);
+		if (isnull)
+			PG_RETURN_NULL();
+		PG_RETURN_DATUM(result);
+	}
+	if (state == NULL || state->num_vals == 0)
+		PG_RETURN_NULL();
+
+	/* With sorted input, the median is always at the head of the ring */
+	if (state->input_order != MEDIAN_INPUT_UNORDERED)
+		result = state->kernel->fetch(state, state->ring_head);
+	else
+		result = median_state_select(state, state->num_vals / 2);
+
+	/* Hand out a copy, the buffered value belongs to the state */
+	if (!state->typbyval)
+		result = datumCopy(result, false, state->typlen);
+
+	PG_RETURN_DATUM(result);
 }
@@ -0,0 +1,144 @@
+/*
+ * Shared state of the median aggregates.
+ *
+ * Values are buffered in a typed array and the median is found by selection
+ * in the final function. Everything that touches the values themselves goes
+ * through a MedianKernel, a table of routines generated from
+ * median_kernels.h once per native type (plus a generic one for all other
+ * types), so comparisons are inlined into each routine.
+ */
+#ifndef MEDIAN_H
+#define MEDIAN_H
+
+#include <postgres.h>
+#include <lib/stringinfo.h>
+#include <utils/sortsupport.h>
+
+#include "median_compat.h"
+#include "quantile_sketch.h"
+
+typedef struct MedianState MedianState;
+
+/* Type-specialized routines operating on the buffered values */
+typedef struct MedianKernel
+{
+	const char *name;
+	Size		elem_size;
+
+	/* Append a value (not NULL) to the buffer */
+	void		(*ingest) (MedianState *state, Datum value);
+	/* Partially order vals[lo, hi) so that vals[k] is in its sorted position */
+	void		(*select) (MedianState *state, int64 lo, int64 hi, int64 k);
+	/* Fully sort the buffer */
+	void		(*sort) (MedianState *state);
+	/* Return the value at position i of the buffer */
+	Datum		(*fetch) (const MedianState *state, int64 i);
+	/* Append all values of src to dst */
+	void		(*merge) (MedianState *dst, const MedianState *src);
+	/* Write the buffered values to buf */
+	void		(*serialize) (const MedianState *state, StringInfo buf);
+	/* Append count values read from buf */
+	void		(*deserialize) (MedianState *state, StringInfo buf, int64 count);
+	/* Remove one value equal to the given one, if present */
+	bool		(*remove) (MedianState *state, Datum value);
+	/* Append a value (not NULL) to the ring buffer of sorted input */
+	void		(*ring_push) (MedianState *state, Datum value);
+	/* Return the value of rank n / 2 of n <= MEDIAN_NETWORK_MAX values */
+	Datum		(*network_median) (MedianState *state, Datum *values, int n);
+	/* Count the values below the given one in the sorted buffer */
+	int64		(*lower_bound) (MedianState *state, Datum value);
+} MedianKernel;
+
+/* Largest number of values for which there is a sorting network */
+#define MEDIAN_NETWORK_MAX 9
+
+/* Order in which values are known to arrive */
+typedef enum MedianInputOrder
+{
+	MEDIAN_INPUT_UNORDERED,
+	MEDIAN_INPUT_ASCENDING,
+	MEDIAN_INPUT_DESCENDING
+} MedianInputOrder;
+
+/*
+ * A value buffer handed from group to group. Sorted aggregation has only
+ * one group in progress at a time, so each new group can take over the
+ * buffer of the previous one instead of growing its own from scratch.
+ */
+typedef struct MedianBuffer
+{
+	MemoryContext context;		/* lives as long as the query */
+	void	   *vals;
+	Size		size;			/* in bytes */
+} MedianBuffer;
+
+/* The DS to store internal state: the buffered values and their type */
+struct MedianState
+{
+	const MedianKernel *kernel;
+	int64		num_vals;
+	int64		capacity;
+	void	   *vals;			/* array of kernel->elem_size elements */
+	MemoryContext agg_context;	/* holds the state and vals */
+	MemoryContext value_context;	/* holds copies of by-reference values */
+	bool		moving;			/* values may be removed again */
+	MedianBuffer *buffer;		/* where vals came from, if reused */
+
+	/*
+	 * With sorted input, only the values that can still end up as the median
+	 * are kept, as a ring buffer of num_vals values starting at ring_head.
+	 * The num_dropped values before them are gone.
+	 */
+	MedianInputOrder input_order;
+	int64		ring_head;
+	int64		num_dropped;
+
+	Oid			typid;
+	Oid			collation;
+	int16		typlen;
+	bool		typbyval;
+	SortSupport ssup;			/* comparator, for the generic kernel only */
+
+	/*
+	 * With median.mode = approximate or auto, the values move into a sketch
+	 * once there are more than approximate_threshold of them. From then on
+	 * the buffer is empty, and infinities and NaNs are only counted.
+	 */
+	bool		approximate;
+	double		approximate_accuracy;
+	int64		approximate_threshold;
+	QuantileSketch *sketch;
+	int64		num_neg_inf;
+	int64		num_pos_inf;
+	int64		num_nan;
+};
+
+extern bool median_agg_hashed(FunctionCallInfo fcinfo);
+extern MedianState *median_state_create(MemoryContext agg_context, Oid typid,
+										Oid collation, bool moving, bool hashed);
+extern void median_state_use_buffer(MedianState *state, MedianBuffer *buffer);
+extern void median_state_grow(MedianState *state, int64 min_capacity);
+extern Datum median_state_select(MedianState *state, int64 k);
+extern void median_state_select_ranks(MedianState *state, const int64 *ranks,
+									  int nranks, Datum *values);
+extern void median_state_push_sorted(MedianState *state, Datum value);
+extern void median_state_reset(MedianState *state);
+
+/* median_approx.c */
+extern void median_approx_init(void);
+extern bool median_approx_supported(Oid typid);
+extern void median_approx_setup(MedianState *state);
+extern void median_approx_start(MedianState *state);
+extern void median_approx_add(MedianState *state, Datum value);
+extern void median_approx_merge(MedianState *dst, const MedianState *src);
+extern Datum median_approx_result(MedianState *state, bool *isnull);
+extern void median_approx_serialize(const MedianState *state, StringInfo buf);
+extern void median_approx_deserialize(MedianState *state, StringInfo buf);
+
+/* median_rollup.c */
+extern void median_rollup_init(void);
+
+/* median_coalesce.c */
+extern void median_coalesce_init(void);
+
+#endif							/* MEDIAN_H */
@@ -0,0 +1,313 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <libpq/pqformat.h>
+#include <utils/float.h>
+#include <utils/guc.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+
+/*
+ * Approximate medians.
+ *
+ * With median.mode = approximate, median() of a numeric type keeps a
+ * quantile sketch instead of the values, so a group takes a few kilobytes
+ * however many rows it has, and the result is within
+ * median.approximate_accuracy of the exact median. With median.mode = auto,
+ * a group is buffered exactly up to median.approximate_threshold values and
+ * only then moves its values into a sketch, so small groups still get exact
+ * results.
+ *
+ * Infinities and NaNs have no place in the sketch and are counted apart;
+ * they sort below (-Infinity) and above (Infinity, then NaN) all other
+ * values, as they do for median().
+ *
+ * Only plain median(x) over int2, int4, int8, float4 and float8 is
+ * approximated. Ordered input, window frames and the percentile aggregates
+ * sharing the transition function stay exact.
+ */
+
+typedef enum MedianMode
+{
+	MEDIAN_MODE_EXACT,
+	MEDIAN_MODE_APPROXIMATE,
+	MEDIAN_MODE_AUTO
+} MedianMode;
+
+static const struct config_enum_entry median_mode_options[] = {
+	{"exact", MEDIAN_MODE_EXACT, false},
+	{"approximate", MEDIAN_MODE_APPROXIMATE, false},
+	{"auto", MEDIAN_MODE_AUTO, false},
+	{NULL, 0, false}
+};
+
+static int	median_mode = MEDIAN_MODE_EXACT;
+static double median_approximate_accuracy = QUANTILE_SKETCH_RELATIVE_ACCURACY;
+static int	median_approximate_threshold = 1000000;
+
+static double median_approx_value(const MedianState *state, Datum value);
+
+/*
+ * Define the settings of the approximate median.
+ */
+void
+median_approx_init(void)
+{
+	DefineCustomEnumVariable("median.mode",
+							 "Whether median() buffers all values or approximates with a sketch.",
+							 "\"exact\" always buffers the values, \"approximate\" always uses a sketch "
+							 "and \"auto\" switches to a sketch at median.approximate_threshold values.",
+							 &median_mode,
+							 MEDIAN_MODE_EXACT,
+							 median_mode_options,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomRealVariable("median.approximate_accuracy",
+							 "Relative accuracy of approximate medians.",
+							 NULL,
+							 &median_approximate_accuracy,
+							 QUANTILE_SKETCH_RELATIVE_ACCURACY, 0.0001, 0.1,
+							 PGC_USERSET,
+							 0,
+							 NULL, NULL, NULL);
+
+	DefineCustomIntVariable("median.approximate_threshold",
+							"Number of values per group at which median.mode = auto switches to a sketch.",
+							NULL,
+							&median_approximate_threshold,
+							1000000, 0, INT_MAX,
+							PGC_USERSET,
+							0,
+							NULL, NULL, NULL);
+}
+
+/*
+ * Whether median() of values of this type can be approximated.
+ */
+bool
+median_approx_supported(Oid typid)
+{
+	switch (typid)
+	{
+		case INT2OID:
+		case INT4OID:
+		case INT8OID:
+		case FLOAT4OID:
+		case FLOAT8OID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Let a new state switch to a sketch according to the current settings, if
+ * its type allows. As the settings can change between statements, the
+ * support functions of median() that call this are STABLE.
+ */
+void
+median_approx_setup(MedianState *state)
+{
+	if (median_mode == MEDIAN_MODE_EXACT || !median_approx_supported(state->typid))
+		return;
+
+	state->approximate = true;
+	state->approximate_accuracy = median_approximate_accuracy;
+	state->approximate_threshold = median_mode == MEDIAN_MODE_APPROXIMATE ? 0 :
+		median_approximate_threshold;
+}
+
+/* The value as float8, for the sketch */
+static double
+median_approx_value(const MedianState *state, Datum value)
+{
+	switch (state->typid)
+	{
+		case INT2OID:
+			return DatumGetInt16(value);
+		case INT4OID:
+			return DatumGetInt32(value);
+		case INT8OID:
+			return (double) DatumGetInt64(value);
+		case FLOAT4OID:
+			return DatumGetFloat4(value);
+		default:
+			return DatumGetFloat8(value);
+	}
+}
+
+/*
+ * Move the buffered values into a new sketch. A buffer kept across groups
+ * stays with the next group, any other is freed.
+ */
+void
+median_approx_start(MedianState *state)
+{
+	int64		i;
+
+	Assert(state->approximate && state->sketch == NULL);
+	Assert(state->input_order == MEDIAN_INPUT_UNORDERED);
+
+	state->sketch = (QuantileSketch *) MemoryContextAlloc(state->agg_context,
+														  sizeof(QuantileSketch));
+	quantile_sketch_init(state->sketch, state->agg_context,
+						 state->approximate_accuracy);
+
+	for (i = 0; i < state->num_vals; i++)
+		median_approx_add(state, state->kernel->fetch(state, i));
+
+	state->num_vals = 0;
+	if (state->buffer == NULL && state->vals != NULL)
+	{
+		pfree(state->vals);
+		state->vals = NULL;
+		state->capacity = 0;
+	}
+}
+
+/*
+ * Add a value (not NULL) to the sketch of the state.
+ */
+void
+median_approx_add(MedianState *state, Datum value)
+{
+	double		v = median_approx_value(state, value);
+
+	if (isnan(v))
+		state->num_nan++;
+	else if (isinf(v))
+	{
+		if (v > 0)
+			state->num_pos_inf++;
+		else
+			state->num_neg_inf++;
+	}
+	else
+		quantile_sketch_add(state->sketch, v, 1);
+}
+
+/*
+ * Add the values or sketch of src to the sketch of dst, which is started
+ * first if need be.
+ */
+void
+median_approx_merge(MedianState *dst, const MedianState *src)
+{
+	int64		i;
+
+	if (dst->sketch == NULL)
+	{
+		/* Follow src if it is the one that switched */
+		if (src->sketch != NULL)
+		{
+			dst->approximate = true;
+			dst->approximate_accuracy = src->approximate_accuracy;
+		}
+		median_approx_start(dst);
+	}
+
+	if (src->sketch == NULL)
+	{
+		for (i = 0; i < src->num_vals; i++)
+			median_approx_add(dst, src->kernel->fetch(src, i));
+		return;
+	}
+
+	/* All states of a query are made with the same settings */
+	if (src->sketch->gamma != dst->sketch->gamma)
+		elog(ERROR, "cannot merge median sketches of different accuracies");
+
+	quantile_sketch_merge(dst->sketch, src->sketch, 1);
+	dst->num_neg_inf += src->num_neg_inf;
+	dst->num_pos_inf += src->num_pos_inf;
+	dst->num_nan += src->num_nan;
+}
+
+/*
+ * The approximate median of a state with a sketch: the value of rank n / 2
+ * (0-based) as median() picks it, or NULL without values. Integer types get
+ * the estimate rounded and kept within their range.
+ */
+Datum
+median_approx_result(MedianState *state, bool *isnull)
+{
+	double		count = quantile_sketch_count(state->sketch);
+	int64		n = state->num_neg_inf + (int64) count + state->num_pos_inf +
+		state->num_nan;
+	int64		rank = n / 2;
+	double		result;
+
+	*isnull = false;
+	if (n == 0)
+	{
+		*isnull = true;
+		return (Datum) 0;
+	}
+
+	if (rank < state->num_neg_inf)
+		result = -get_float8_infinity();
+	else if ((rank -= state->num_neg_inf) < (int64) count)
+	{
+		if (!quantile_sketch_quantile(state->sketch, (rank + 1) / count, &result))
+			elog(ERROR, "empty median sketch");
+	}
+	else if (rank - (int64) count < state->num_pos_inf)
+		result = get_float8_infinity();
+	else
+		result = get_float8_nan();
+
+	switch (state->typid)
+	{
+		case INT2OID:
+			return Int16GetDatum((int16) Max(Min(rint(result), PG_INT16_MAX), PG_INT16_MIN));
+		case INT4OID:
+			return Int32GetDatum((int32) Max(Min(rint(result), PG_INT32_MAX), PG_INT32_MIN));
+		case INT8OID:
+			/* (double) PG_INT64_MAX rounds up to 2^63, which is out of range */
+			result = rint(result);
+			if (result >= (double) PG_INT64_MAX)
+				return Int64GetDatum(PG_INT64_MAX);
+			if (result <= (double) PG_INT64_MIN)
+				return Int64GetDatum(PG_INT64_MIN);
+			return Int64GetDatum((int64) result);
+		case FLOAT4OID:
+			return Float4GetDatum((float4) result);
+		default:
+			return Float8GetDatum(result);
+	}
+}
+
+/*
+ * Write the sketch of a state, after the counts of the values it leaves out.
+ */
+void
+median_approx_serialize(const MedianState *state, StringInfo buf)
+{
+	pq_sendfloat8(buf, state->approximate_accuracy);
+	pq_sendint64(buf, state->num_neg_inf);
+	pq_sendint64(buf, state->num_pos_inf);
+	pq_sendint64(buf, state->num_nan);
+	quantile_sketch_send(buf, state->sketch);
+}
+
+/*
+ * Read what median_approx_serialize wrote into a new, empty state.
+ */
+void
+median_approx_deserialize(MedianState *state, StringInfo buf)
+{
+	state->approximate = true;
+	state->approximate_accuracy = pq_getmsgfloat8(buf);
+	state->approximate_threshold = 0;
+	state->sketch = (QuantileSketch *) MemoryContextAlloc(state->agg_context,
+														  sizeof(QuantileSketch));
+	quantile_sketch_init(state->sketch, state->agg_context,
+						 state->approximate_accuracy);
+	state->num_neg_inf = pq_getmsgint64(buf);
+	state->num_pos_inf = pq_getmsgint64(buf);
+	state->num_nan = pq_getmsgint64(buf);
+	quantile_sketch_receive(state->sketch, buf);
+}
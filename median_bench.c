@@ -0,0 +1,147 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <lib/stringinfo.h>
+#include <libpq/pqformat.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+#include "median_networks.h"
+
+/*
+ * Comparison counts of the selection kernel, for bench/select.sql.
+ *
+ * The int8 kernel is instantiated once more with a comparator that counts
+ * its calls. In adversary mode, the buffer holds element numbers instead of
+ * values, and the comparator decides the values only as the algorithm looks
+ * at them, as in McIlroy's "A Killer Adversary for Quicksort": all elements
+ * start out as "gas", which sorts above every decided value, and when two
+ * gas elements meet, the one that took part in the previous comparison
+ * (most likely the pivot) is frozen to the next smallest value. That makes
+ * every pivot as bad as the values compared so far allow, whatever rule
+ * picked it.
+ *
+ * This file is not part of median.so. "make bench" builds it as a module of
+ * its own, whose functions the benchmark script declares in pg_temp.
+ */
+
+PG_FUNCTION_INFO_V1(median_select_comparisons);
+PG_FUNCTION_INFO_V1(median_select_adversary_comparisons);
+
+typedef struct MedianBench
+{
+	int64		comparisons;
+	int64	   *values;			/* decided values in adversary mode, or NULL */
+	int64		gas;			/* value of undecided elements */
+	int64		num_solid;		/* number of decided elements */
+	int64		candidate;		/* gas element of the last comparison */
+} MedianBench;
+
+static MedianBench median_bench;
+
+static inline bool
+median_bench_lt(int64 a, int64 b)
+{
+	int64	   *values = median_bench.values;
+
+	median_bench.comparisons++;
+	if (values == NULL)
+		return a < b;
+
+	if (values[a] == median_bench.gas && values[b] == median_bench.gas)
+	{
+		if (a == median_bench.candidate)
+			values[a] = median_bench.num_solid++;
+		else
+			values[b] = median_bench.num_solid++;
+	}
+	if (values[a] == median_bench.gas)
+		median_bench.candidate = a;
+	else if (values[b] == median_bench.gas)
+		median_bench.candidate = b;
+
+	return values[a] < values[b];
+}
+
+#define MK_PREFIX median_bench
+#define MK_TYPE int64
+#define MK_FROM_DATUM(d) DatumGetInt64(d)
+#define MK_TO_DATUM(x) Int64GetDatum(x)
+#define MK_LT(state, a, b) median_bench_lt(a, b)
+#include "median_kernels.h"
+
+/* Select the median of the first n elements of vals, counting comparisons */
+static float8
+median_bench_run(int64 *vals, int64 n)
+{
+	MedianState state;
+
+	memset(&state, 0, sizeof(state));
+	state.kernel = &median_bench_kernel;
+	state.vals = vals;
+	state.num_vals = n;
+	state.capacity = n;
+
+	median_bench.comparisons = 0;
+	state.kernel->select(&state, 0, n, n / 2);
+
+	return (float8) median_bench.comparisons / n;
+}
+
+/*
+ * median_select_comparisons(int8[]): comparisons per value to select the
+ * median of the array's elements.
+ */
+Datum
+median_select_comparisons(PG_FUNCTION_ARGS)
+{
+	ArrayType  *array = PG_GETARG_ARRAYTYPE_P_COPY(0);
+	int64		n = ArrayGetNItems(ARR_NDIM(array), ARR_DIMS(array));
+
+	if (ARR_ELEMTYPE(array) != INT8OID || ARR_HASNULL(array))
+		elog(ERROR, "expected an int8 array without NULLs");
+	if (n == 0)
+		PG_RETURN_NULL();
+
+	median_bench.values = NULL;
+	PG_RETURN_FLOAT8(median_bench_run((int64 *) ARR_DATA_PTR(array), n));
+}
+
+/*
+ * median_select_adversary_comparisons(int8): comparisons per value to
+ * select the median of n values chosen by the adversary.
+ */
+Datum
+median_select_adversary_comparisons(PG_FUNCTION_ARGS)
+{
+	int64		n = PG_GETARG_INT64(0);
+	int64	   *elements;
+	int64		i;
+	float8		result;
+
+	if (n <= 0 || (Size) n > MaxAllocSize / (2 * sizeof(int64)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of values must be between 1 and %zu",
+						MaxAllocSize / (2 * sizeof(int64)))));
+
+	elements = (int64 *) palloc(n * sizeof(int64));
+	median_bench.values = (int64 *) palloc(n * sizeof(int64));
+	median_bench.gas = n;
+	median_bench.num_solid = 0;
+	median_bench.candidate = 0;
+	for (i = 0; i < n; i++)
+	{
+		elements[i] = i;
+		median_bench.values[i] = n;
+	}
+
+	result = median_bench_run(elements, n);
+
+	pfree(median_bench.values);
+	median_bench.values = NULL;
+	pfree(elements);
+
+	PG_RETURN_FLOAT8(result);
+}
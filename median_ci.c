@@ -0,0 +1,243 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <math.h>
+#include <access/htup_details.h>
+#include <libpq/pqformat.h>
+#include <utils/builtins.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+
+/*
+ * Distribution-free confidence interval of the median.
+ *
+ * For n values with order statistics x(1) <= ... <= x(n), the interval
+ * [x(k), x(n + 1 - k)] contains the population median with probability
+ * P(k <= B <= n - k) for B ~ Binomial(n, 1/2), whatever the distribution of
+ * the values. median_ci(val, confidence) picks the narrowest such interval
+ * that reaches the confidence level and returns it with the median, which
+ * takes three selections over the buffered values.
+ *
+ * The coverage is summed outwards from the middle of the binomial
+ * distribution, so finding k takes about sqrt(n) steps rather than n.
+ */
+
+PG_FUNCTION_INFO_V1(median_ci_transfn);
+PG_FUNCTION_INFO_V1(median_ci_finalfn);
+PG_FUNCTION_INFO_V1(median_ci_combinefn);
+PG_FUNCTION_INFO_V1(median_ci_serialfn);
+PG_FUNCTION_INFO_V1(median_ci_deserialfn);
+
+typedef struct MedianCIState
+{
+	double		confidence;
+	MedianState *values;		/* float8 value buffer */
+} MedianCIState;
+
+static MedianCIState *median_ci_state_create(MemoryContext agg_context,
+											 double confidence, bool hashed);
+static int64 median_ci_rank(int64 n, double confidence);
+
+static MedianCIState *
+median_ci_state_create(MemoryContext agg_context, double confidence,
+					   bool hashed)
+{
+	MedianCIState *state;
+
+	state = (MedianCIState *) MemoryContextAlloc(agg_context, sizeof(MedianCIState));
+	state->confidence = confidence;
+	state->values = median_state_create(agg_context, FLOAT8OID, InvalidOid, false,
+										hashed);
+	return state;
+}
+
+/*
+ * Return the largest k (1-based) such that [x(k), x(n + 1 - k)] has at
+ * least the given coverage, or 0 if even [x(1), x(n)] falls short.
+ */
+static int64
+median_ci_rank(int64 n, double confidence)
+{
+	int64		k = n / 2;
+	double		pmf;
+	double		coverage;
+
+	if (k == 0)
+		return 0;
+
+	/* P(B = k) at the middle, then P(k <= B <= n - k) */
+	pmf = exp(lgamma((double) n + 1) - lgamma((double) k + 1) -
+			  lgamma((double) (n - k) + 1) - n * log(2.0));
+	coverage = (n - k == k) ? pmf : 2 * pmf;
+
+	while (coverage < confidence)
+	{
+		if (k <= 1)
+			return 0;
+		pmf *= (double) k / (n - k + 1);
+		k--;
+		coverage += 2 * pmf;
+	}
+	return k;
+}
+
+/*
+ * Transition function of median_ci(val float8, confidence float8).
+ *
+ * The confidence level is taken from the first row, like the fraction of
+ * percentile_disc. NULL values are ignored.
+ */
+Datum
+median_ci_transfn(PG_FUNCTION_ARGS)
+{
+	MedianCIState *state = NULL;
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_ci_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		state = (MedianCIState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	if (state == NULL)
+	{
+		double		confidence;
+
+		if (PG_ARGISNULL(2))
+			ereport(ERROR,
+					(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+					 errmsg("median_ci confidence level must not be NULL")));
+
+		confidence = PG_GETARG_FLOAT8(2);
+		if (!(confidence > 0 && confidence < 1))
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("confidence level %g is not between 0 and 1", confidence)));
+
+		state = median_ci_state_create(agg_context, confidence,
+									   median_agg_hashed(fcinfo));
+	}
+
+	state->values->kernel->ingest(state->values, PG_GETARG_DATUM(1));
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Final function of median_ci, returning (lower, median, upper). The bounds
+ * are NULL when there are too few values to reach the confidence level.
+ */
+Datum
+median_ci_finalfn(PG_FUNCTION_ARGS)
+{
+	MedianCIState *state;
+	TupleDesc	tupdesc;
+	int64		n;
+	int64		k;
+	int64		ranks[3];
+	Datum		values[3];
+	bool		nulls[3] = {false, false, false};
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_ci_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (MedianCIState *) PG_GETARG_POINTER(0);
+	if (state == NULL || state->values->num_vals == 0)
+		PG_RETURN_NULL();
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	n = state->values->num_vals;
+	k = median_ci_rank(n, state->confidence);
+
+	/* Same median as median(), the upper one of two middle values */
+	ranks[0] = k > 0 ? k - 1 : 0;
+	ranks[1] = n / 2;
+	ranks[2] = k > 0 ? n - k : 0;
+	median_state_select_ranks(state->values, ranks, 3, values);
+	nulls[0] = nulls[2] = (k == 0);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(tupdesc),
+													  values, nulls)));
+}
+
+Datum
+median_ci_combinefn(PG_FUNCTION_ARGS)
+{
+	MedianCIState *state1;
+	MedianCIState *state2;
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_ci_combinefn called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (MedianCIState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (MedianCIState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+	{
+		if (state1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
+	}
+
+	if (state1 == NULL)
+		state1 = median_ci_state_create(agg_context, state2->confidence,
+										median_agg_hashed(fcinfo));
+
+	state1->values->kernel->merge(state1->values, state2->values);
+
+	PG_RETURN_POINTER(state1);
+}
+
+Datum
+median_ci_serialfn(PG_FUNCTION_ARGS)
+{
+	MedianCIState *state;
+	StringInfoData buf;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_ci_serialfn called in non-aggregate context");
+
+	state = (MedianCIState *) PG_GETARG_POINTER(0);
+
+	pq_begintypsend(&buf);
+	pq_sendfloat8(&buf, state->confidence);
+	pq_sendint64(&buf, state->values->num_vals);
+	state->values->kernel->serialize(state->values, &buf);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+median_ci_deserialfn(PG_FUNCTION_ARGS)
+{
+	bytea	   *sstate;
+	MedianCIState *state;
+	MemoryContext agg_context;
+	StringInfoData buf;
+	int64		num_vals;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_ci_deserialfn called in non-aggregate context");
+
+	sstate = PG_GETARG_BYTEA_PP(0);
+
+	buf.data = VARDATA_ANY(sstate);
+	buf.len = VARSIZE_ANY_EXHDR(sstate);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+
+	state = median_ci_state_create(agg_context, pq_getmsgfloat8(&buf),
+								   median_agg_hashed(fcinfo));
+	num_vals = pq_getmsgint64(&buf);
+	state->values->kernel->deserialize(state->values, &buf, num_vals);
+	pq_getmsgend(&buf);
+
+	PG_RETURN_POINTER(state);
+}
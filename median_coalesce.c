@@ -0,0 +1,574 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <access/xact.h>
+#include <catalog/namespace.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <nodes/nodeFuncs.h>
+#include <nodes/parsenodes.h>
+#include <pgstat.h>
+#include <storage/condition_variable.h>
+#include <storage/ipc.h>
+#include <storage/lwlock.h>
+#include <storage/proc.h>
+#include <storage/shmem.h>
+#include <tcop/tcopprot.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/fmgroids.h>
+#include <utils/guc.h>
+#include <utils/lsyscache.h>
+#include <utils/plancache.h>
+#include <utils/rls.h>
+#include "catalog/pg_proc_d.h"
+
+#include "median.h"
+
+/*
+ * Coalescing of concurrent identical medians.
+ *
+ * median_coalesced(relation, column, filter) computes
+ * median(column)::float8 over the rows of relation matching filter. When
+ * several backends ask for the same median at the same time, e.g. a
+ * dashboard refreshed by many users, only the first one (the leader) scans
+ * the table. The others (followers) find its computation in a registry in
+ * shared memory, wait for it and take its result.
+ *
+ * Two requests are the same if they come from the same user in the same
+ * database, for the same relation, column and filter text, with the same
+ * settings that affect how the filter is parsed and evaluated, and the
+ * relation's modification counters in the statistics system are unchanged.
+ * Requests whose result depends on more of the session than that are never
+ * coalesced: those reading a table with row-level security, whose policies
+ * can depend on anything, and those whose filter calls volatile functions
+ * or reads settings with current_setting().
+ * Since the counters only move when other backends report their statistics,
+ * a follower can get a result that lacks rows committed shortly before it
+ * started; a request is only ever coalesced with a computation that is
+ * still in flight, so it is never older than that.
+ *
+ * The registry needs median in shared_preload_libraries. Without it, and
+ * for requests that cannot be coalesced safely, the median is computed
+ * directly. A leader that fails hands the request back to its followers,
+ * which then compute it themselves.
+ */
+
+#define MEDIAN_COALESCE_SLOTS		64
+#define MEDIAN_COALESCE_MAX_FILTER	1024
+#define MEDIAN_COALESCE_MAX_SETTINGS	1024
+
+PG_FUNCTION_INFO_V1(median_coalesced);
+
+/* Session settings that can change the meaning of a filter */
+static const char *const coalesce_settings[] = {
+	"search_path",
+	"TimeZone",
+	"DateStyle",
+	"IntervalStyle",
+	"standard_conforming_strings"
+};
+
+typedef struct MedianCoalesceKey
+{
+	Oid			dbid;
+	Oid			userid;
+	Oid			relid;
+	AttrNumber	attnum;
+	int64		num_changes;	/* rows inserted, updated and deleted */
+	int64		num_live;
+	char		filter[MEDIAN_COALESCE_MAX_FILTER];
+	char		settings[MEDIAN_COALESCE_MAX_SETTINGS]; /* NUL-separated values */
+} MedianCoalesceKey;
+
+typedef struct MedianCoalesceSlot
+{
+	MedianCoalesceKey key;
+	bool		in_use;
+	bool		done;			/* the leader has finished */
+	bool		failed;			/* ... without a result */
+	bool		isnull;
+	float8		result;
+	int			num_waiting;	/* followers yet to take the result */
+	PGPROC	   *leader;
+	ConditionVariable cv;
+} MedianCoalesceSlot;
+
+typedef struct MedianCoalesceShared
+{
+	LWLock	   *lock;			/* protects the slots, except their cv */
+	MedianCoalesceSlot slots[MEDIAN_COALESCE_SLOTS];
+} MedianCoalesceShared;
+
+static MedianCoalesceShared *coalesce_shared = NULL;
+
+#ifdef MEDIAN_HAVE_SHMEM_REQUEST_HOOK
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static void coalesce_shmem_request(void);
+static void coalesce_shmem_startup(void);
+static bool coalesce_make_key(MedianCoalesceKey *key, Oid relid, AttrNumber attnum,
+							  const char *filter);
+static void coalesce_check_query(const char *query, const char *filter);
+static bool coalesce_shareable(const char *query);
+static bool coalesce_unshareable_walker(Node *node, void *context);
+static bool coalesce_unshareable_function(Oid funcid, void *context);
+static float8 coalesce_compute(const char *query, bool *isnull);
+static float8 coalesce_lead(MedianCoalesceSlot *slot, const char *query, bool *isnull);
+static float8 coalesce_follow(MedianCoalesceSlot *slot, const char *query, bool *isnull);
+static void coalesce_finish(MedianCoalesceSlot *slot, bool failed, float8 result,
+							bool isnull);
+static void coalesce_leader_abort(int code, Datum arg);
+static void coalesce_follower_abort(int code, Datum arg);
+
+/*
+ * Reserve the shared memory of the registry, when loaded at server start.
+ */
+void
+median_coalesce_init(void)
+{
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#ifdef MEDIAN_HAVE_SHMEM_REQUEST_HOOK
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook = coalesce_shmem_request;
+#else
+	coalesce_shmem_request();
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = coalesce_shmem_startup;
+}
+
+static void
+coalesce_shmem_request(void)
+{
+#ifdef MEDIAN_HAVE_SHMEM_REQUEST_HOOK
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+#endif
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(MedianCoalesceShared)));
+	RequestNamedLWLockTranche("median_coalesce", 1);
+}
+
+static void
+coalesce_shmem_startup(void)
+{
+	bool		found;
+	int			i;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	coalesce_shared = ShmemInitStruct("median_coalesce",
+									  sizeof(MedianCoalesceShared), &found);
+	if (!found)
+	{
+		memset(coalesce_shared, 0, sizeof(MedianCoalesceShared));
+		coalesce_shared->lock = &(GetNamedLWLockTranche("median_coalesce"))->lock;
+		for (i = 0; i < MEDIAN_COALESCE_SLOTS; i++)
+			ConditionVariableInit(&coalesce_shared->slots[i].cv);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Fill in the key of a request from the relation's modification counters
+ * and the session's settings. Returns false if the request must not be
+ * coalesced: when the current transaction has changed the relation, its
+ * rows differ from what other backends see, and when the session has
+ * temporary tables, a filter could refer to them. Settings too long for
+ * the key also prevent coalescing.
+ */
+static bool
+coalesce_make_key(MedianCoalesceKey *key, Oid relid, AttrNumber attnum,
+				  const char *filter)
+{
+	Oid			argtypes[1] = {OIDOID};
+	Datum		values[1];
+	HeapTuple	tuple;
+	TupleDesc	tupdesc;
+	bool		isnull;
+	Oid			temp_namespace;
+	Oid			temp_toast_namespace;
+	Size		settings_len = 0;
+	int			i;
+
+	GetTempNamespaceState(&temp_namespace, &temp_toast_namespace);
+	if (filter != NULL && OidIsValid(temp_namespace))
+		return false;
+
+	values[0] = ObjectIdGetDatum(relid);
+	if (SPI_execute_with_args("SELECT pg_catalog.pg_stat_get_tuples_inserted($1) + "
+							  "pg_catalog.pg_stat_get_tuples_updated($1) + "
+							  "pg_catalog.pg_stat_get_tuples_deleted($1), "
+							  "pg_catalog.pg_stat_get_live_tuples($1), "
+							  "pg_catalog.pg_stat_get_xact_tuples_inserted($1) + "
+							  "pg_catalog.pg_stat_get_xact_tuples_updated($1) + "
+							  "pg_catalog.pg_stat_get_xact_tuples_deleted($1)",
+							  1, argtypes, values, NULL, true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "could not read the statistics of relation with OID %u", relid);
+
+	tuple = SPI_tuptable->vals[0];
+	tupdesc = SPI_tuptable->tupdesc;
+	if (DatumGetInt64(SPI_getbinval(tuple, tupdesc, 3, &isnull)) != 0)
+		return false;
+
+	/* Zeroed, padding included, so that keys compare with memcmp */
+	memset(key, 0, sizeof(MedianCoalesceKey));
+	key->dbid = MyDatabaseId;
+	key->userid = GetUserId();
+	key->relid = relid;
+	key->attnum = attnum;
+	key->num_changes = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+	key->num_live = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+	if (filter != NULL)
+		strlcpy(key->filter, filter, MEDIAN_COALESCE_MAX_FILTER);
+
+	for (i = 0; i < lengthof(coalesce_settings); i++)
+	{
+		const char *value = GetConfigOption(coalesce_settings[i], false, false);
+		Size		len = strlen(value) + 1;
+
+		if (settings_len + len > MEDIAN_COALESCE_MAX_SETTINGS)
+			return false;
+		memcpy(key->settings + settings_len, value, len);
+		settings_len += len;
+	}
+
+	return true;
+}
+
+/*
+ * Check that the filter pasted into the median query only added to its
+ * WHERE clause, instead of closing the parenthesis and appending other
+ * clauses, set operations or further statements.
+ */
+static void
+coalesce_check_query(const char *query, const char *filter)
+{
+	List	   *parsetree = pg_parse_query(query);
+	Node	   *stmt = NULL;
+	SelectStmt *select;
+
+	if (list_length(parsetree) == 1)
+		stmt = linitial_node(RawStmt, parsetree)->stmt;
+	select = stmt != NULL && IsA(stmt, SelectStmt) ? (SelectStmt *) stmt : NULL;
+
+	if (select == NULL || select->op != SETOP_NONE || select->groupClause != NIL ||
+		select->havingClause != NULL || select->windowClause != NIL ||
+		select->sortClause != NIL || select->limitOffset != NULL ||
+		select->limitCount != NULL || select->lockingClause != NIL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("filter \"%s\" is not a single condition", filter)));
+}
+
+/*
+ * Check whether the result of the median query depends on nothing but the
+ * key of a request, on the query as analyzed and rewritten. Must be called
+ * while connected to SPI.
+ */
+static bool
+coalesce_shareable(const char *query)
+{
+	SPIPlanPtr	plan = SPI_prepare(query, 0, NULL);
+	CachedPlanSource *source;
+	bool		shareable;
+
+	if (plan == NULL)
+		elog(ERROR, "could not prepare the median query");
+
+	source = linitial(SPI_plan_get_plan_sources(plan));
+	shareable = !coalesce_unshareable_walker((Node *) source->query_list, NULL);
+	SPI_freeplan(plan);
+
+	return shareable;
+}
+
+static bool
+coalesce_unshareable_walker(Node *node, void *context)
+{
+	if (node == NULL)
+		return false;
+
+	if (IsA(node, Query))
+	{
+		Query	   *query = (Query *) node;
+		ListCell   *lc;
+
+		foreach(lc, query->rtable)
+		{
+			RangeTblEntry *rte = lfirst_node(RangeTblEntry, lc);
+
+			if (rte->rtekind == RTE_RELATION &&
+				check_enable_rls(rte->relid, InvalidOid, true) != RLS_NONE)
+				return true;
+		}
+		return query_tree_walker(query, coalesce_unshareable_walker, context, 0);
+	}
+
+	if (check_functions_in_node(node, coalesce_unshareable_function, context))
+		return true;
+
+	return expression_tree_walker(node, coalesce_unshareable_walker, context);
+}
+
+static bool
+coalesce_unshareable_function(Oid funcid, void *context)
+{
+	return func_volatile(funcid) == PROVOLATILE_VOLATILE ||
+		funcid == F_CURRENT_SETTING_TEXT ||
+		funcid == F_CURRENT_SETTING_TEXT_BOOL;
+}
+
+/*
+ * Run the median query. Must be called while connected to SPI.
+ */
+static float8
+coalesce_compute(const char *query, bool *isnull)
+{
+	if (SPI_execute(query, true, 1) != SPI_OK_SELECT || SPI_processed != 1)
+		elog(ERROR, "could not compute the median");
+
+	*isnull = false;
+	return DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0],
+										SPI_tuptable->tupdesc, 1, isnull));
+}
+
+/*
+ * Compute the median for a slot claimed by this backend and publish the
+ * result to the followers.
+ */
+static float8
+coalesce_lead(MedianCoalesceSlot *slot, const char *query, bool *isnull)
+{
+	float8		result;
+
+	PG_ENSURE_ERROR_CLEANUP(coalesce_leader_abort, PointerGetDatum(slot));
+	{
+		result = coalesce_compute(query, isnull);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(coalesce_leader_abort, PointerGetDatum(slot));
+
+	coalesce_finish(slot, false, result, *isnull);
+	return result;
+}
+
+/*
+ * Wait for the leader of a slot, which counts this backend among its
+ * followers, and take its result. If the leader failed, compute the median
+ * here instead.
+ *
+ * The deadlock detector does not see this wait. The statement calling us
+ * can hold locks, e.g. on a table it updates, and the leader may need one
+ * of them. So, as the deadlock detector would, check every deadlock_timeout
+ * whether the leader waits for a lock, and if so stop following and compute
+ * the median here, where any conflict is visible again.
+ */
+static float8
+coalesce_follow(MedianCoalesceSlot *slot, const char *query, bool *isnull)
+{
+	volatile PGPROC *leader = slot->leader;
+	bool		done;
+	bool		failed;
+	float8		result;
+
+	PG_ENSURE_ERROR_CLEANUP(coalesce_follower_abort, PointerGetDatum(slot));
+	{
+		ConditionVariablePrepareToSleep(&slot->cv);
+		for (;;)
+		{
+			LWLockAcquire(coalesce_shared->lock, LW_SHARED);
+			done = slot->done;
+			LWLockRelease(coalesce_shared->lock);
+
+			if (done)
+				break;
+			if (ConditionVariableTimedSleep(&slot->cv, DeadlockTimeout, PG_WAIT_EXTENSION) &&
+				leader->waitLock != NULL)
+				break;
+		}
+		ConditionVariableCancelSleep();
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(coalesce_follower_abort, PointerGetDatum(slot));
+
+	LWLockAcquire(coalesce_shared->lock, LW_EXCLUSIVE);
+	done = slot->done;
+	failed = slot->failed;
+	result = slot->result;
+	*isnull = slot->isnull;
+	if (--slot->num_waiting == 0 && done)
+		slot->in_use = false;
+	LWLockRelease(coalesce_shared->lock);
+
+	if (!done || failed)
+		return coalesce_compute(query, isnull);
+	return result;
+}
+
+/*
+ * Publish the outcome of a leader's computation. The slot is freed by the
+ * last follower to take the result, or here if there are none.
+ */
+static void
+coalesce_finish(MedianCoalesceSlot *slot, bool failed, float8 result, bool isnull)
+{
+	LWLockAcquire(coalesce_shared->lock, LW_EXCLUSIVE);
+	slot->done = true;
+	slot->failed = failed;
+	slot->result = result;
+	slot->isnull = isnull;
+	if (slot->num_waiting == 0)
+		slot->in_use = false;
+	LWLockRelease(coalesce_shared->lock);
+
+	ConditionVariableBroadcast(&slot->cv);
+}
+
+static void
+coalesce_leader_abort(int code, Datum arg)
+{
+	coalesce_finish((MedianCoalesceSlot *) DatumGetPointer(arg), true, 0, true);
+}
+
+static void
+coalesce_follower_abort(int code, Datum arg)
+{
+	MedianCoalesceSlot *slot = (MedianCoalesceSlot *) DatumGetPointer(arg);
+
+	LWLockAcquire(coalesce_shared->lock, LW_EXCLUSIVE);
+	if (--slot->num_waiting == 0 && slot->done)
+		slot->in_use = false;
+	LWLockRelease(coalesce_shared->lock);
+}
+
+/*
+ * median_coalesced(relation, column, filter)
+ *
+ * The median of a column as float8, over the rows matching filter (an SQL
+ * condition, or NULL for all rows), shared with concurrent identical
+ * requests.
+ */
+Datum
+median_coalesced(PG_FUNCTION_ARGS)
+{
+	Oid			relid;
+	Name		column;
+	char	   *filter = NULL;
+	char	   *relname;
+	AttrNumber	attnum;
+	StringInfoData query;
+	MedianCoalesceKey key;
+	MedianCoalesceSlot *slot = NULL;
+	bool		leader = false;
+	bool		isnull;
+	float8		result;
+	int			i;
+
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	relid = PG_GETARG_OID(0);
+	column = PG_GETARG_NAME(1);
+	if (!PG_ARGISNULL(2))
+		filter = text_to_cstring(PG_GETARG_TEXT_PP(2));
+
+	relname = get_rel_name(relid);
+	if (relname == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg("relation with OID %u does not exist", relid)));
+
+	if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("permission denied for table %s", relname)));
+
+	attnum = get_attnum(relid, NameStr(*column));
+	if (attnum == InvalidAttrNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						NameStr(*column), relname)));
+
+	/* median() is in the schema of this function */
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT %s.median(%s)::float8 FROM %s",
+					 quote_identifier(get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid))),
+					 quote_identifier(NameStr(*column)),
+					 quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)),
+												relname));
+	if (filter != NULL)
+	{
+		appendStringInfo(&query, " WHERE (%s)", filter);
+		coalesce_check_query(query.data, filter);
+	}
+
+	SPI_connect();
+
+	/*
+	 * Only coalesce outside transaction blocks: a follower waits for the
+	 * leader without the deadlock detector knowing, so it should not hold
+	 * locks from earlier statements that the leader could wait for. Those of
+	 * the current statement are dealt with in coalesce_follow().
+	 */
+	if (coalesce_shared != NULL && !IsTransactionBlock() &&
+		(filter == NULL || strlen(filter) < MEDIAN_COALESCE_MAX_FILTER) &&
+		coalesce_shareable(query.data) &&
+		coalesce_make_key(&key, relid, attnum, filter))
+	{
+		MedianCoalesceSlot *free_slot = NULL;
+
+		LWLockAcquire(coalesce_shared->lock, LW_EXCLUSIVE);
+		for (i = 0; i < MEDIAN_COALESCE_SLOTS; i++)
+		{
+			MedianCoalesceSlot *s = &coalesce_shared->slots[i];
+
+			if (!s->in_use)
+			{
+				if (free_slot == NULL)
+					free_slot = s;
+			}
+			else if (!s->done && memcmp(&s->key, &key, sizeof(key)) == 0)
+			{
+				slot = s;
+				break;
+			}
+		}
+
+		if (slot != NULL)
+			slot->num_waiting++;
+		else if (free_slot != NULL)
+		{
+			slot = free_slot;
+			slot->key = key;
+			slot->in_use = true;
+			slot->done = false;
+			slot->failed = false;
+			slot->num_waiting = 0;
+			slot->leader = MyProc;
+			leader = true;
+		}
+		LWLockRelease(coalesce_shared->lock);
+	}
+
+	if (slot == NULL)
+		result = coalesce_compute(query.data, &isnull);
+	else if (leader)
+		result = coalesce_lead(slot, query.data, &isnull);
+	else
+		result = coalesce_follow(slot, query.data, &isnull);
+
+	SPI_finish();
+
+	if (isnull)
+		PG_RETURN_NULL();
+	PG_RETURN_FLOAT8(result);
+}
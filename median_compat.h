@@ -0,0 +1,103 @@
+/*
+ * Compatibility layer for the supported PostgreSQL versions.
+ *
+ * All version-conditional code lives here so that the aggregate code itself
+ * can use the newest available facilities without sprinkling
+ * PG_VERSION_NUM checks around.
+ */
+#ifndef MEDIAN_COMPAT_H
+#define MEDIAN_COMPAT_H
+
+#include <postgres.h>
+#include <utils/memutils.h>
+
+#if PG_VERSION_NUM < 120000 || PG_VERSION_NUM >= 180000
+#error "Unsupported PostgreSQL version. Use version 12 to 17."
+#endif
+
+/* lib/sort_template.h, for type-specialized sort routines, exists since 14 */
+#if PG_VERSION_NUM >= 140000
+#define MEDIAN_HAVE_SORT_TEMPLATE
+#endif
+
+/* Shared memory is requested from shmem_request_hook since 15 */
+#if PG_VERSION_NUM >= 150000
+#define MEDIAN_HAVE_SHMEM_REQUEST_HOOK
+#endif
+
+/*
+ * Create a memory context for the values of one aggregate group.
+ *
+ * Values are never freed one by one, only all together when the group is
+ * done, which is exactly the allocation pattern of bump contexts (17+). They
+ * have no per-chunk header at all. Older versions fall back to generation
+ * contexts, which at least skip the free-list bookkeeping of aset.c.
+ *
+ * The context is a child of the aggregate context, so it is released with
+ * the group. Hashed aggregation does not use it: each context takes at least
+ * a block, which is too much for a state per group.
+ */
+static inline MemoryContext
+median_value_context_create(MemoryContext parent)
+{
+#if PG_VERSION_NUM >= 170000
+	return BumpContextCreate(parent, "median values", ALLOCSET_SMALL_SIZES);
+#elif PG_VERSION_NUM >= 150000
+	return GenerationContextCreate(parent, "median values", ALLOCSET_SMALL_SIZES);
+#else
+	return GenerationContextCreate(parent, "median values", ALLOCSET_SMALL_INITSIZE);
+#endif
+}
+
+/* common/int.h has the unsigned overflow checks since 13 */
+#if PG_VERSION_NUM < 130000
+static inline bool
+pg_add_u64_overflow(uint64 a, uint64 b, uint64 *result)
+{
+	*result = a + b;
+	return *result < a;
+}
+#endif
+
+/* fmgroids.h names functions after their SQL name since 14 */
+#if PG_VERSION_NUM < 140000
+#define F_CURRENT_SETTING_TEXT F_SHOW_CONFIG_BY_NAME
+#define F_CURRENT_SETTING_TEXT_BOOL F_SHOW_CONFIG_BY_NAME_MISSING_OK
+#endif
+
+/* EmitWarningsOnPlaceholders was renamed in 15 */
+#if PG_VERSION_NUM < 150000
+#define MarkGUCPrefixReserved(className) EmitWarningsOnPlaceholders(className)
+#endif
+
+/*
+ * ConditionVariableTimedSleep exists since 13. Before, wait on the latch,
+ * which ConditionVariableBroadcast sets for the processes that prepared to
+ * sleep on the variable; the caller must have called
+ * ConditionVariablePrepareToSleep. Returns true if the timeout elapsed.
+ */
+#if PG_VERSION_NUM < 130000
+#include <miscadmin.h>
+#include <storage/condition_variable.h>
+#include <storage/latch.h>
+
+static inline bool
+ConditionVariableTimedSleep(ConditionVariable *cv, long timeout,
+							uint32 wait_event_info)
+{
+	int			rc;
+
+	rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+				   timeout, wait_event_info);
+	ResetLatch(MyLatch);
+	CHECK_FOR_INTERRUPTS();
+	return (rc & WL_TIMEOUT) != 0;
+}
+#endif
+
+/* The predefined roles were renamed from DEFAULT_ROLE_* in 14 */
+#if PG_VERSION_NUM < 140000
+#define ROLE_PG_READ_SERVER_FILES DEFAULT_ROLE_READ_SERVER_FILES
+#endif
+
+#endif							/* MEDIAN_COMPAT_H */
@@ -0,0 +1,640 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <funcapi.h>
+#include <access/htup_details.h>
+#include <libpq/pqformat.h>
+#include <port/pg_bitutils.h>
+#include <port/pg_bswap.h>
+#include <utils/builtins.h>
+#include <utils/timestamp.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+
+/*
+ * Medians of compressed time series segments.
+ *
+ * median_compress(ts, val) packs the points of a series into a bytea
+ * segment, with timestamps as delta-of-deltas and values XORed with their
+ * predecessor as in Facebook's Gorilla. median_compressed(segment) and the
+ * aggregate median_compressed_agg(segment) decode the values straight into
+ * a float8 value buffer and select the median there, without a tuple per
+ * point; median_decompress(segment) returns the points as rows.
+ *
+ * A segment holds a header, then the timestamp stream, then the value
+ * stream, each a sequence of bits, most significant first, padded to whole
+ * bytes:
+ *
+ *	version		1 byte
+ *	count		4 bytes, the number of points
+ *	times_len	4 bytes, the length of the timestamp stream in bytes
+ *
+ * Since the values have a stream of their own, medians skip the timestamps
+ * altogether.
+ *
+ * Timestamps: the first one as 64 bits. For each next one, the difference
+ * of its delta from the previous delta, zigzag-encoded, as '0' if zero or
+ * after a prefix of '10', '110', '1110', '11110' or '11111' in 7, 9, 12, 32
+ * or 64 bits.
+ *
+ * Values: the first one as the 64 bits of the float8. For each next one,
+ * the XOR of its bits with the previous value's: '0' if zero; '10' and its
+ * meaningful bits if they fit in the previous meaningful window; otherwise
+ * '11', the number of leading zeros (5 bits, at most 31), the number of
+ * meaningful bits minus one (6 bits) and the meaningful bits.
+ */
+
+#define COMPRESSED_FORMAT_VERSION	1
+#define COMPRESSED_HEADER_SIZE		9
+
+PG_FUNCTION_INFO_V1(median_compress_transfn);
+PG_FUNCTION_INFO_V1(median_compress_finalfn);
+PG_FUNCTION_INFO_V1(median_compressed);
+PG_FUNCTION_INFO_V1(median_compressed_transfn);
+PG_FUNCTION_INFO_V1(median_compressed_finalfn);
+PG_FUNCTION_INFO_V1(median_compressed_combinefn);
+PG_FUNCTION_INFO_V1(median_compressed_serialfn);
+PG_FUNCTION_INFO_V1(median_compressed_deserialfn);
+PG_FUNCTION_INFO_V1(median_decompress);
+
+/* Bits pending in acc, fewer than 8 between writes */
+typedef struct BitWriter
+{
+	StringInfoData buf;
+	uint64		acc;
+	int			nacc;
+} BitWriter;
+
+/* Bits not yet read, left-aligned in bits */
+typedef struct BitReader
+{
+	const uint8 *data;
+	const uint8 *end;
+	uint64		bits;
+	int			nbits;
+} BitReader;
+
+typedef struct MedianCompressState
+{
+	int64		count;
+	int64		prev_time;
+	int64		prev_delta;
+	uint64		prev_value;
+	int			prev_leading;	/* meaningful window, or -1 if none yet */
+	int			prev_trailing;
+	BitWriter	times;
+	BitWriter	values;
+} MedianCompressState;
+
+/* A segment's header, pointing into the segment */
+typedef struct CompressedSegment
+{
+	int64		count;
+	const uint8 *times;
+	int			times_len;
+	const uint8 *values;
+	int			values_len;
+} CompressedSegment;
+
+typedef struct CompressedPoints
+{
+	int64	   *times;
+	float8	   *values;
+} CompressedPoints;
+
+static void bits_write(BitWriter *writer, uint64 value, int n);
+static inline uint64 bits_read(BitReader *reader, int n);
+static void compressed_parse(bytea *data, CompressedSegment *segment);
+static void compressed_decode_times(const CompressedSegment *segment, int64 *out);
+static void compressed_decode_values(const CompressedSegment *segment, float8 *out);
+static void compressed_ingest(MedianState *state, bytea *data);
+
+/*
+ * Append the low n bits (1 to 64) of value.
+ */
+static void
+bits_write(BitWriter *writer, uint64 value, int n)
+{
+	if (n > 32)
+	{
+		bits_write(writer, value >> 32, n - 32);
+		value &= PG_UINT32_MAX;
+		n = 32;
+	}
+
+	writer->acc = (writer->acc << n) | (value & ((UINT64CONST(1) << n) - 1));
+	writer->nacc += n;
+	while (writer->nacc >= 8)
+	{
+		writer->nacc -= 8;
+		appendStringInfoCharMacro(&writer->buf, (char) (writer->acc >> writer->nacc));
+	}
+}
+
+/*
+ * Read the next n bits (1 to 64), refilling a word at a time.
+ */
+static inline uint64
+bits_read(BitReader *reader, int n)
+{
+	uint64		result = 0;
+
+	while (n > 0)
+	{
+		int			take;
+
+		if (reader->nbits == 0)
+		{
+			if (reader->end - reader->data >= 8)
+			{
+				memcpy(&reader->bits, reader->data, 8);
+				reader->bits = pg_ntoh64(reader->bits);
+				reader->data += 8;
+				reader->nbits = 64;
+			}
+			else if (reader->data < reader->end)
+			{
+				reader->bits = 0;
+				while (reader->data < reader->end)
+				{
+					reader->bits |= (uint64) *reader->data++ << (56 - reader->nbits);
+					reader->nbits += 8;
+				}
+			}
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						 errmsg("invalid compressed segment")));
+		}
+
+		take = Min(n, reader->nbits);
+		if (take == 64)
+		{
+			result = reader->bits;
+			reader->bits = 0;
+		}
+		else
+		{
+			result = (result << take) | (reader->bits >> (64 - take));
+			reader->bits <<= take;
+		}
+		reader->nbits -= take;
+		n -= take;
+	}
+	return result;
+}
+
+/*
+ * Check the header of a segment and find its streams. Each point takes at
+ * least a bit of each stream, which bounds the count.
+ */
+static void
+compressed_parse(bytea *data, CompressedSegment *segment)
+{
+	StringInfoData buf;
+
+	buf.data = VARDATA_ANY(data);
+	buf.len = VARSIZE_ANY_EXHDR(data);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+
+	if (buf.len < COMPRESSED_HEADER_SIZE ||
+		pq_getmsgbyte(&buf) != COMPRESSED_FORMAT_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid compressed segment")));
+
+	segment->count = (uint32) pq_getmsgint(&buf, 4);
+	segment->times_len = (uint32) pq_getmsgint(&buf, 4);
+	segment->values_len = buf.len - buf.cursor - segment->times_len;
+
+	if (segment->times_len < 0 || segment->values_len < 0 ||
+		(segment->count > 0 &&
+		 (segment->times_len < 8 || segment->values_len < 8 ||
+		  segment->count - 1 > (int64) (segment->times_len - 8) * 8 ||
+		  segment->count - 1 > (int64) (segment->values_len - 8) * 8)))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid compressed segment")));
+
+	segment->times = (const uint8 *) buf.data + buf.cursor;
+	segment->values = segment->times + segment->times_len;
+}
+
+/*
+ * Decode the timestamps of a segment into out. Arithmetic is unsigned, so
+ * that a corrupt stream wraps around rather than overflows.
+ */
+static void
+compressed_decode_times(const CompressedSegment *segment, int64 *out)
+{
+	BitReader	reader = {segment->times, segment->times + segment->times_len, 0, 0};
+	uint64		time;
+	uint64		delta = 0;
+	int64		i;
+
+	if (segment->count == 0)
+		return;
+
+	time = bits_read(&reader, 64);
+	out[0] = (int64) time;
+	for (i = 1; i < segment->count; i++)
+	{
+		uint64		zigzag;
+
+		if (bits_read(&reader, 1) == 0)
+			zigzag = 0;
+		else if (bits_read(&reader, 1) == 0)
+			zigzag = bits_read(&reader, 7);
+		else if (bits_read(&reader, 1) == 0)
+			zigzag = bits_read(&reader, 9);
+		else if (bits_read(&reader, 1) == 0)
+			zigzag = bits_read(&reader, 12);
+		else if (bits_read(&reader, 1) == 0)
+			zigzag = bits_read(&reader, 32);
+		else
+			zigzag = bits_read(&reader, 64);
+
+		delta += (zigzag >> 1) ^ -(zigzag & 1);
+		time += delta;
+		out[i] = (int64) time;
+	}
+}
+
+/*
+ * Decode the values of a segment into out.
+ */
+static void
+compressed_decode_values(const CompressedSegment *segment, float8 *out)
+{
+	BitReader	reader = {segment->values, segment->values + segment->values_len, 0, 0};
+	uint64		value;
+	bool		have_window = false;
+	int			leading = 0;
+	int			trailing = 0;
+	int64		i;
+
+	if (segment->count == 0)
+		return;
+
+	value = bits_read(&reader, 64);
+	memcpy(&out[0], &value, sizeof(float8));
+	for (i = 1; i < segment->count; i++)
+	{
+		if (bits_read(&reader, 1) != 0)
+		{
+			if (bits_read(&reader, 1) != 0)
+			{
+				leading = (int) bits_read(&reader, 5);
+				trailing = 64 - leading - ((int) bits_read(&reader, 6) + 1);
+				if (trailing < 0)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+							 errmsg("invalid compressed segment")));
+				have_window = true;
+			}
+			else if (!have_window)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						 errmsg("invalid compressed segment")));
+			value ^= bits_read(&reader, 64 - leading - trailing) << trailing;
+		}
+		memcpy(&out[i], &value, sizeof(float8));
+	}
+}
+
+/*
+ * Append the values of a segment to a float8 value buffer, grown once for
+ * all of them.
+ */
+static void
+compressed_ingest(MedianState *state, bytea *data)
+{
+	CompressedSegment segment;
+
+	compressed_parse(data, &segment);
+	median_state_grow(state, state->num_vals + segment.count);
+	compressed_decode_values(&segment, (float8 *) state->vals + state->num_vals);
+	state->num_vals += segment.count;
+}
+
+/*
+ * Transition function of median_compress(ts timestamptz, val float8). Rows
+ * with a NULL timestamp or value are skipped.
+ */
+Datum
+median_compress_transfn(PG_FUNCTION_ARGS)
+{
+	MedianCompressState *state = NULL;
+	MemoryContext agg_context;
+	int64		time;
+	float8		float_value;
+	uint64		value;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_compress_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		state = (MedianCompressState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		PG_RETURN_POINTER(state);
+
+	time = PG_GETARG_TIMESTAMPTZ(1);
+	float_value = PG_GETARG_FLOAT8(2);
+	memcpy(&value, &float_value, sizeof(uint64));
+
+	if (state == NULL)
+	{
+		MemoryContext oldcontext = MemoryContextSwitchTo(agg_context);
+
+		state = (MedianCompressState *) palloc0(sizeof(MedianCompressState));
+		initStringInfo(&state->times.buf);
+		initStringInfo(&state->values.buf);
+		MemoryContextSwitchTo(oldcontext);
+
+		state->prev_leading = -1;
+		bits_write(&state->times, (uint64) time, 64);
+		bits_write(&state->values, value, 64);
+	}
+	else
+	{
+		uint64		delta = (uint64) time - (uint64) state->prev_time;
+		int64		dod = (int64) (delta - (uint64) state->prev_delta);
+		uint64		zigzag = ((uint64) dod << 1) ^ (uint64) (dod >> 63);
+		uint64		xor = value ^ state->prev_value;
+
+		if (state->count >= PG_UINT32_MAX)
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("too many points for a compressed segment")));
+
+		if (zigzag == 0)
+			bits_write(&state->times, 0, 1);
+		else if (zigzag < (UINT64CONST(1) << 7))
+			bits_write(&state->times, (UINT64CONST(0x2) << 7) | zigzag, 2 + 7);
+		else if (zigzag < (UINT64CONST(1) << 9))
+			bits_write(&state->times, (UINT64CONST(0x6) << 9) | zigzag, 3 + 9);
+		else if (zigzag < (UINT64CONST(1) << 12))
+			bits_write(&state->times, (UINT64CONST(0xE) << 12) | zigzag, 4 + 12);
+		else if (zigzag < (UINT64CONST(1) << 32))
+			bits_write(&state->times, (UINT64CONST(0x1E) << 32) | zigzag, 5 + 32);
+		else
+		{
+			bits_write(&state->times, 0x1F, 5);
+			bits_write(&state->times, zigzag, 64);
+		}
+
+		if (xor == 0)
+			bits_write(&state->values, 0, 1);
+		else
+		{
+			int			leading = Min(63 - pg_leftmost_one_pos64(xor), 31);
+			int			trailing = pg_rightmost_one_pos64(xor);
+
+			if (state->prev_leading >= 0 && leading >= state->prev_leading &&
+				trailing >= state->prev_trailing)
+			{
+				bits_write(&state->values, 0x2, 2);
+				bits_write(&state->values, xor >> state->prev_trailing,
+						   64 - state->prev_leading - state->prev_trailing);
+			}
+			else
+			{
+				int			length = 64 - leading - trailing;
+
+				bits_write(&state->values, (0x3 << 11) | (leading << 6) | (length - 1),
+						   2 + 5 + 6);
+				bits_write(&state->values, xor >> trailing, length);
+				state->prev_leading = leading;
+				state->prev_trailing = trailing;
+			}
+		}
+		state->prev_delta = (int64) delta;
+	}
+
+	state->prev_time = time;
+	state->prev_value = value;
+	state->count++;
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Final function of median_compress, giving the segment. The pending bits
+ * are padded in the result only, so the state can take more rows.
+ */
+Datum
+median_compress_finalfn(PG_FUNCTION_ARGS)
+{
+	MedianCompressState *state;
+	StringInfoData buf;
+	int			times_len;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_compress_finalfn called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+	state = (MedianCompressState *) PG_GETARG_POINTER(0);
+
+	times_len = state->times.buf.len + (state->times.nacc > 0);
+
+	pq_begintypsend(&buf);
+	pq_sendbyte(&buf, COMPRESSED_FORMAT_VERSION);
+	pq_sendint32(&buf, (uint32) state->count);
+	pq_sendint32(&buf, times_len);
+	pq_sendbytes(&buf, state->times.buf.data, state->times.buf.len);
+	if (state->times.nacc > 0)
+		pq_sendbyte(&buf, (uint8) (state->times.acc << (8 - state->times.nacc)));
+	pq_sendbytes(&buf, state->values.buf.data, state->values.buf.len);
+	if (state->values.nacc > 0)
+		pq_sendbyte(&buf, (uint8) (state->values.acc << (8 - state->values.nacc)));
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * median_compressed(segment): the median of the values of a segment, as
+ * median() picks it, or NULL for an empty segment.
+ */
+Datum
+median_compressed(PG_FUNCTION_ARGS)
+{
+	MedianState *state = median_state_create(CurrentMemoryContext, FLOAT8OID,
+											 InvalidOid, false, false);
+
+	compressed_ingest(state, PG_GETARG_BYTEA_PP(0));
+	if (state->num_vals == 0)
+		PG_RETURN_NULL();
+
+	PG_RETURN_DATUM(median_state_select(state, state->num_vals / 2));
+}
+
+/*
+ * Transition function of median_compressed_agg(segment), the median of the
+ * values of all segments. NULL segments are ignored.
+ */
+Datum
+median_compressed_transfn(PG_FUNCTION_ARGS)
+{
+	MedianState *state = NULL;
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_compressed_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		state = (MedianState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	if (state == NULL)
+		state = median_state_create(agg_context, FLOAT8OID, InvalidOid, false,
+									median_agg_hashed(fcinfo));
+	compressed_ingest(state, PG_GETARG_BYTEA_PP(1));
+
+	PG_RETURN_POINTER(state);
+}
+
+Datum
+median_compressed_finalfn(PG_FUNCTION_ARGS)
+{
+	MedianState *state;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_compressed_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (MedianState *) PG_GETARG_POINTER(0);
+	if (state == NULL || state->num_vals == 0)
+		PG_RETURN_NULL();
+
+	PG_RETURN_DATUM(median_state_select(state, state->num_vals / 2));
+}
+
+Datum
+median_compressed_combinefn(PG_FUNCTION_ARGS)
+{
+	MedianState *state1;
+	MedianState *state2;
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_compressed_combinefn called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (MedianState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (MedianState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+	{
+		if (state1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
+	}
+
+	if (state1 == NULL)
+		state1 = median_state_create(agg_context, FLOAT8OID, InvalidOid, false,
+									 median_agg_hashed(fcinfo));
+
+	state1->kernel->merge(state1, state2);
+
+	PG_RETURN_POINTER(state1);
+}
+
+Datum
+median_compressed_serialfn(PG_FUNCTION_ARGS)
+{
+	MedianState *state;
+	StringInfoData buf;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_compressed_serialfn called in non-aggregate context");
+
+	state = (MedianState *) PG_GETARG_POINTER(0);
+
+	pq_begintypsend(&buf);
+	pq_sendint64(&buf, state->num_vals);
+	state->kernel->serialize(state, &buf);
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+median_compressed_deserialfn(PG_FUNCTION_ARGS)
+{
+	bytea	   *sstate;
+	MedianState *state;
+	MemoryContext agg_context;
+	StringInfoData buf;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_compressed_deserialfn called in non-aggregate context");
+
+	sstate = PG_GETARG_BYTEA_PP(0);
+
+	buf.data = VARDATA_ANY(sstate);
+	buf.len = VARSIZE_ANY_EXHDR(sstate);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+
+	state = median_state_create(agg_context, FLOAT8OID, InvalidOid, false,
+								median_agg_hashed(fcinfo));
+	state->kernel->deserialize(state, &buf, pq_getmsgint64(&buf));
+	pq_getmsgend(&buf);
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * median_decompress(segment): the points of a segment as (ts, val) rows.
+ */
+Datum
+median_decompress(PG_FUNCTION_ARGS)
+{
+	FuncCallContext *funcctx;
+	CompressedPoints *points;
+
+	if (SRF_IS_FIRSTCALL())
+	{
+		MemoryContext oldcontext;
+		TupleDesc	tupdesc;
+		CompressedSegment segment;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+		if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+			elog(ERROR, "return type must be a row type");
+		funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+		compressed_parse(PG_GETARG_BYTEA_PP(0), &segment);
+		points = (CompressedPoints *) palloc(sizeof(CompressedPoints));
+		points->times = (int64 *) MemoryContextAllocHuge(CurrentMemoryContext,
+														 Max(segment.count, 1) * sizeof(int64));
+		points->values = (float8 *) MemoryContextAllocHuge(CurrentMemoryContext,
+														   Max(segment.count, 1) * sizeof(float8));
+		compressed_decode_times(&segment, points->times);
+		compressed_decode_values(&segment, points->values);
+
+		funcctx->user_fctx = points;
+		funcctx->max_calls = segment.count;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	funcctx = SRF_PERCALL_SETUP();
+	points = (CompressedPoints *) funcctx->user_fctx;
+
+	if (funcctx->call_cntr < funcctx->max_calls)
+	{
+		Datum		values[2];
+		bool		nulls[2] = {false, false};
+
+		values[0] = TimestampTzGetDatum(points->times[funcctx->call_cntr]);
+		values[1] = Float8GetDatum(points->values[funcctx->call_cntr]);
+		SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc,
+																	values, nulls)));
+	}
+
+	SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,342 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <common/int.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/lsyscache.h>
+#include <utils/sortsupport.h>
+#include <utils/timestamp.h>
+#include <utils/typcache.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+
+/*
+ * Median of consecutive differences.
+ *
+ * median_delta(x) is the median of x - lag(x), e.g. of inter-arrival times
+ * for timestamps, computed within the aggregate instead of with a window
+ * function below it. Values are differenced as they arrive, so the input
+ * order matters: either the aggregate orders its input (ORDER BY), or an
+ * order key is given as the second argument. In the latter case the
+ * (key, value) pairs are buffered and sorted by key in the final function.
+ *
+ * median_counter_delta(x) treats x as a monotonic counter the way Prometheus
+ * does: a decrease is a counter reset, and the increase since the reset is
+ * the new value itself.
+ *
+ * The differences go into a MedianState of int8 (for integers and
+ * timestamps) or float8, which does the selection.
+ */
+
+#define MEDIAN_DELTA_INITIAL_CAPACITY 64
+
+PG_FUNCTION_INFO_V1(median_delta_transfn);
+PG_FUNCTION_INFO_V1(median_delta_keyed_transfn);
+PG_FUNCTION_INFO_V1(median_counter_delta_transfn);
+PG_FUNCTION_INFO_V1(median_counter_delta_keyed_transfn);
+PG_FUNCTION_INFO_V1(median_delta_finalfn);
+PG_FUNCTION_INFO_V1(median_delta_interval_finalfn);
+
+/* An input value with its order key */
+typedef struct MedianDeltaPair
+{
+	Datum		key;
+	Datum		value;
+} MedianDeltaPair;
+
+typedef struct MedianDeltaState
+{
+	MedianState *deltas;		/* the differences, int8 or float8 */
+	Oid			typid;			/* type of the input values */
+	bool		typbyval;		/* not on platforms with 4-byte Datums */
+	bool		counter;		/* a decrease is a counter reset */
+	MemoryContext agg_context;
+
+	/* Without an order key, the previous value in arrival order */
+	bool		have_prev;
+	Datum		prev;
+
+	/* With an order key, the pairs are differenced in the final function */
+	bool		keyed;
+	bool		sorted;			/* pairs sorted and differenced */
+	int64		num_pairs;
+	int64		capacity;
+	MedianDeltaPair *pairs;
+	int16		key_typlen;
+	bool		key_typbyval;
+	SortSupport key_ssup;
+} MedianDeltaState;
+
+static Datum median_delta_transfn_common(FunctionCallInfo fcinfo, bool counter,
+										 bool keyed);
+static MedianDeltaState *median_delta_init(FunctionCallInfo fcinfo,
+										   MemoryContext agg_context,
+										   bool counter, bool keyed);
+static Datum median_delta_diff(MedianDeltaState *state, Datum prev, Datum value);
+static MedianState *median_delta_get_deltas(FunctionCallInfo fcinfo);
+static int	median_delta_pair_cmp(const void *a, const void *b, void *arg);
+
+/*
+ * Transition function of median_delta(value).
+ */
+Datum
+median_delta_transfn(PG_FUNCTION_ARGS)
+{
+	return median_delta_transfn_common(fcinfo, false, false);
+}
+
+/*
+ * Transition function of median_delta(value, order_key).
+ */
+Datum
+median_delta_keyed_transfn(PG_FUNCTION_ARGS)
+{
+	return median_delta_transfn_common(fcinfo, false, true);
+}
+
+/*
+ * Transition function of median_counter_delta(value).
+ */
+Datum
+median_counter_delta_transfn(PG_FUNCTION_ARGS)
+{
+	return median_delta_transfn_common(fcinfo, true, false);
+}
+
+/*
+ * Transition function of median_counter_delta(value, order_key).
+ */
+Datum
+median_counter_delta_keyed_transfn(PG_FUNCTION_ARGS)
+{
+	return median_delta_transfn_common(fcinfo, true, true);
+}
+
+static MedianDeltaState *
+median_delta_init(FunctionCallInfo fcinfo, MemoryContext agg_context,
+				  bool counter, bool keyed)
+{
+	MedianDeltaState *state;
+	Oid			typid = get_fn_expr_argtype(fcinfo->flinfo, 1);
+
+	state = (MedianDeltaState *) MemoryContextAllocZero(agg_context, sizeof(MedianDeltaState));
+	state->typid = typid;
+	state->typbyval = get_typbyval(typid);
+	state->counter = counter;
+	state->keyed = keyed;
+	state->agg_context = agg_context;
+	state->deltas = median_state_create(agg_context,
+										typid == FLOAT8OID ? FLOAT8OID : INT8OID,
+										InvalidOid, false,
+										median_agg_hashed(fcinfo));
+
+	if (keyed)
+	{
+		Oid			key_typid = get_fn_expr_argtype(fcinfo->flinfo, 2);
+		TypeCacheEntry *typentry = lookup_type_cache(key_typid, TYPECACHE_LT_OPR);
+
+		if (!OidIsValid(typentry->lt_opr))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify an ordering operator for type %s",
+							format_type_be(key_typid))));
+
+		get_typlenbyval(key_typid, &state->key_typlen, &state->key_typbyval);
+		state->key_ssup = (SortSupport) MemoryContextAllocZero(agg_context, sizeof(SortSupportData));
+		state->key_ssup->ssup_cxt = agg_context;
+		state->key_ssup->ssup_collation = PG_GET_COLLATION();
+		state->key_ssup->ssup_nulls_first = false;
+		PrepareSortSupportFromOrderingOp(typentry->lt_opr, state->key_ssup);
+
+		state->capacity = MEDIAN_DELTA_INITIAL_CAPACITY;
+		state->pairs = (MedianDeltaPair *) MemoryContextAllocHuge(agg_context,
+																  state->capacity * sizeof(MedianDeltaPair));
+	}
+
+	return state;
+}
+
+static Datum
+median_delta_transfn_common(FunctionCallInfo fcinfo, bool counter, bool keyed)
+{
+	MedianDeltaState *state;
+	MemoryContext agg_context;
+	MemoryContext old_context;
+	Datum		value;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "median_delta_transfn called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		state = median_delta_init(fcinfo, agg_context, counter, keyed);
+	else
+		state = (MedianDeltaState *) PG_GETARG_POINTER(0);
+
+	/* Rows with a NULL value or key are skipped */
+	if (PG_ARGISNULL(1) || (keyed && PG_ARGISNULL(2)))
+		PG_RETURN_POINTER(state);
+
+	old_context = MemoryContextSwitchTo(agg_context);
+	value = state->typbyval ? PG_GETARG_DATUM(1) :
+		datumCopy(PG_GETARG_DATUM(1), false, sizeof(int64));
+
+	if (!keyed)
+	{
+		if (state->have_prev)
+		{
+			state->deltas->kernel->ingest(state->deltas,
+										  median_delta_diff(state, state->prev, value));
+			if (!state->typbyval)
+				pfree(DatumGetPointer(state->prev));
+		}
+		state->prev = value;
+		state->have_prev = true;
+		MemoryContextSwitchTo(old_context);
+		PG_RETURN_POINTER(state);
+	}
+
+	if (state->num_pairs >= state->capacity)
+	{
+		if ((Size) state->capacity * 2 > MaxAllocHugeSize / sizeof(MedianDeltaPair))
+			ereport(ERROR,
+					(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+					 errmsg("too many values for median_delta aggregate")));
+		state->capacity *= 2;
+		state->pairs = (MedianDeltaPair *) repalloc_huge(state->pairs,
+														 state->capacity * sizeof(MedianDeltaPair));
+	}
+
+	state->pairs[state->num_pairs].value = value;
+	state->pairs[state->num_pairs].key = datumCopy(PG_GETARG_DATUM(2),
+												   state->key_typbyval,
+												   state->key_typlen);
+	state->num_pairs++;
+	state->sorted = false;
+	MemoryContextSwitchTo(old_context);
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Difference between two consecutive values, as an int8 or float8 Datum.
+ */
+static Datum
+median_delta_diff(MedianDeltaState *state, Datum prev, Datum value)
+{
+	int64		result;
+
+	switch (state->typid)
+	{
+		case FLOAT8OID:
+			{
+				float8		p = DatumGetFloat8(prev);
+				float8		v = DatumGetFloat8(value);
+
+				if (state->counter && v < p)
+					return Float8GetDatum(v);
+				return Float8GetDatum(v - p);
+			}
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			if (TIMESTAMP_NOT_FINITE(DatumGetTimestamp(prev)) ||
+				TIMESTAMP_NOT_FINITE(DatumGetTimestamp(value)))
+				ereport(ERROR,
+						(errcode(ERRCODE_DATETIME_VALUE_OUT_OF_RANGE),
+						 errmsg("cannot subtract infinite timestamps")));
+			break;
+		default:
+			if (state->counter && DatumGetInt64(value) < DatumGetInt64(prev))
+				return value;
+			break;
+	}
+
+	if (pg_sub_s64_overflow(DatumGetInt64(value), DatumGetInt64(prev), &result))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("bigint out of range")));
+	return Int64GetDatum(result);
+}
+
+/* qsort_arg comparator ordering pairs by key */
+static int
+median_delta_pair_cmp(const void *a, const void *b, void *arg)
+{
+	const MedianDeltaPair *pa = (const MedianDeltaPair *) a;
+	const MedianDeltaPair *pb = (const MedianDeltaPair *) b;
+
+	return ApplySortComparator(pa->key, false, pb->key, false, (SortSupport) arg);
+}
+
+/*
+ * Return the state holding the differences, or NULL if there are none.
+ *
+ * With an order key, the pairs are sorted and differenced here. The state
+ * may get more values after that when used as a window aggregate, in which
+ * case this is done again.
+ */
+static MedianState *
+median_delta_get_deltas(FunctionCallInfo fcinfo)
+{
+	MedianDeltaState *state;
+	int64		i;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "median_delta_finalfn called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		return NULL;
+	state = (MedianDeltaState *) PG_GETARG_POINTER(0);
+
+	if (state->keyed && !state->sorted)
+	{
+		qsort_arg(state->pairs, state->num_pairs, sizeof(MedianDeltaPair),
+				  median_delta_pair_cmp, state->key_ssup);
+
+		state->deltas->num_vals = 0;
+		for (i = 1; i < state->num_pairs; i++)
+			state->deltas->kernel->ingest(state->deltas,
+										  median_delta_diff(state,
+															state->pairs[i - 1].value,
+															state->pairs[i].value));
+		state->sorted = true;
+	}
+
+	return state->deltas->num_vals > 0 ? state->deltas : NULL;
+}
+
+/*
+ * Final function for int8 and float8 input, whose differences have the
+ * input type.
+ */
+Datum
+median_delta_finalfn(PG_FUNCTION_ARGS)
+{
+	MedianState *deltas = median_delta_get_deltas(fcinfo);
+
+	if (deltas == NULL)
+		PG_RETURN_NULL();
+
+	PG_RETURN_DATUM(median_state_select(deltas, deltas->num_vals / 2));
+}
+
+/*
+ * Final function for timestamp and timestamptz input. The result is an
+ * interval justified to days the same way timestamp subtraction does.
+ */
+Datum
+median_delta_interval_finalfn(PG_FUNCTION_ARGS)
+{
+	MedianState *deltas = median_delta_get_deltas(fcinfo);
+	Interval   *result;
+
+	if (deltas == NULL)
+		PG_RETURN_NULL();
+
+	result = (Interval *) palloc(sizeof(Interval));
+	result->time = DatumGetInt64(median_state_select(deltas, deltas->num_vals / 2));
+	result->day = 0;
+	result->month = 0;
+
+	return DirectFunctionCall1(interval_justify_hours, IntervalPGetDatum(result));
+}
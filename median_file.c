@@ -0,0 +1,591 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <mb/pg_wchar.h>
+#include <port/pg_bswap.h>
+#include <storage/fd.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include "catalog/pg_authid_d.h"
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+
+/*
+ * median_from_file(path, column_index, format): the median of one column of
+ * a data file on the server, without loading the file into a table first.
+ *
+ * The file is read in large chunks and parsed one row at a time; only the
+ * field of the requested column is collected, converted with the input (or,
+ * for binary files, receive) function of the value type and appended to a
+ * typed value buffer as median() keeps it. The formats are those of COPY:
+ * "text" (tab-separated, \N for NULL), "csv" (comma-separated, with quoting)
+ * and "binary". NULLs are ignored.
+ *
+ * Reading server files takes the same privileges as COPY FROM a file:
+ * superuser or membership in pg_read_server_files. Relative paths are
+ * relative to the data directory.
+ */
+
+PG_FUNCTION_INFO_V1(median_from_file);
+PG_FUNCTION_INFO_V1(median_from_file_typed);
+
+#define MEDIAN_FILE_BUFFER_SIZE		(1024 * 1024)
+
+typedef enum MedianFileFormat
+{
+	MEDIAN_FILE_TEXT,
+	MEDIAN_FILE_CSV,
+	MEDIAN_FILE_BINARY
+} MedianFileFormat;
+
+typedef struct MedianFileReader
+{
+	const char *path;
+	FILE	   *file;
+	char	   *buf;
+	int			len;			/* bytes in buf */
+	int			pos;			/* next byte to read */
+	int64		row;			/* current row, for error messages */
+} MedianFileReader;
+
+/* Signature at the start of COPY binary files */
+static const char median_file_binary_signature[11] = "PGCOPY\n\377\r\n\0";
+
+static Datum median_from_file_common(FunctionCallInfo fcinfo, Oid typid, bool header,
+									 bool *isnull);
+static int	median_file_fill(MedianFileReader *reader);
+static void median_file_read(MedianFileReader *reader, char *dst, int len);
+static int32 median_file_read_int32(MedianFileReader *reader);
+static bool median_file_text_row(MedianFileReader *reader, int column, StringInfo field,
+								 bool *isnull);
+static bool median_file_csv_row(MedianFileReader *reader, int column, StringInfo field,
+								bool *isnull);
+static bool median_file_binary_row(MedianFileReader *reader, int column, StringInfo field,
+								   bool *isnull);
+static void median_file_verify_field(StringInfo field);
+static void median_file_error_callback(void *arg);
+
+/* Next byte of the file, or EOF */
+static inline int
+median_file_getc(MedianFileReader *reader)
+{
+	if (reader->pos < reader->len)
+		return (unsigned char) reader->buf[reader->pos++];
+	return median_file_fill(reader);
+}
+
+/*
+ * Refill the buffer and return its first byte, or EOF. This is also where
+ * long reads can be cancelled.
+ */
+static int
+median_file_fill(MedianFileReader *reader)
+{
+	CHECK_FOR_INTERRUPTS();
+
+	reader->len = fread(reader->buf, 1, MEDIAN_FILE_BUFFER_SIZE, reader->file);
+	reader->pos = 0;
+	if (reader->len == 0)
+	{
+		if (ferror(reader->file))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not read file \"%s\": %m", reader->path)));
+		return EOF;
+	}
+	return (unsigned char) reader->buf[reader->pos++];
+}
+
+/* Read len bytes into dst, or skip them if dst is NULL */
+static void
+median_file_read(MedianFileReader *reader, char *dst, int len)
+{
+	while (len > 0)
+	{
+		int			n;
+
+		if (reader->pos == reader->len)
+		{
+			if (median_file_fill(reader) == EOF)
+				ereport(ERROR,
+						(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						 errmsg("unexpected EOF in binary file \"%s\"", reader->path)));
+			reader->pos--;
+		}
+
+		n = Min(len, reader->len - reader->pos);
+		if (dst != NULL)
+		{
+			memcpy(dst, reader->buf + reader->pos, n);
+			dst += n;
+		}
+		reader->pos += n;
+		len -= n;
+	}
+}
+
+static int32
+median_file_read_int32(MedianFileReader *reader)
+{
+	uint32		value;
+
+	median_file_read(reader, (char *) &value, sizeof(value));
+	return (int32) pg_ntoh32(value);
+}
+
+/* Next byte of the file without consuming it, or EOF */
+static inline int
+median_file_peekc(MedianFileReader *reader)
+{
+	int			c;
+
+	if (reader->pos < reader->len)
+		return (unsigned char) reader->buf[reader->pos];
+	c = median_file_fill(reader);
+	if (c != EOF)
+		reader->pos--;
+	return c;
+}
+
+/*
+ * Read a row of a text format file, collecting the field of the given
+ * column (1-based) with its escapes resolved as COPY FROM does: \b, \f, \n,
+ * \r, \t and \v, up to three octal digits after a backslash and up to two
+ * hex digits after \x stand for the character they encode, and a backslash
+ * before any other character just stands for that character. The field is
+ * NULL if it is exactly \N. Returns false at the end of the file.
+ */
+static bool
+median_file_text_row(MedianFileReader *reader, int column, StringInfo field,
+					 bool *isnull)
+{
+	int			fieldno = 1;
+	int			raw_len = 0;	/* bytes of the field before unescaping */
+	bool		null_marker = false;
+	int			c = median_file_getc(reader);
+
+	if (c == EOF)
+		return false;
+
+	resetStringInfo(field);
+	for (; c != EOF && c != '\n'; c = median_file_getc(reader))
+	{
+		if (c == '\t')
+			fieldno++;
+		else if (c == '\\')
+		{
+			if ((c = median_file_getc(reader)) == EOF)
+				break;
+			if (fieldno != column)
+				continue;
+			if (c == 'N' && raw_len == 0)
+				null_marker = true;
+			raw_len += 2;
+			switch (c)
+			{
+				case '0':
+				case '1':
+				case '2':
+				case '3':
+				case '4':
+				case '5':
+				case '6':
+				case '7':
+					{
+						int			val = c - '0';
+						int			ndigits;
+
+						for (ndigits = 1; ndigits < 3; ndigits++)
+						{
+							c = median_file_peekc(reader);
+							if (c < '0' || c > '7')
+								break;
+							val = (val << 3) + c - '0';
+							median_file_getc(reader);
+							raw_len++;
+						}
+						c = val & 0377;
+					}
+					break;
+				case 'x':
+					{
+						int			val = 0;
+						int			ndigits;
+
+						for (ndigits = 0; ndigits < 2; ndigits++)
+						{
+							int			hex = median_file_peekc(reader);
+
+							if (hex == EOF || !isxdigit(hex))
+								break;
+							val = (val << 4) + (isdigit(hex) ? hex - '0' :
+												pg_ascii_tolower(hex) - 'a' + 10);
+							median_file_getc(reader);
+							raw_len++;
+						}
+						if (ndigits > 0)
+							c = val & 0xff;
+					}
+					break;
+				case 'b':
+					c = '\b';
+					break;
+				case 'f':
+					c = '\f';
+					break;
+				case 'n':
+					c = '\n';
+					break;
+				case 'r':
+					c = '\r';
+					break;
+				case 't':
+					c = '\t';
+					break;
+				case 'v':
+					c = '\v';
+					break;
+			}
+			appendStringInfoCharMacro(field, c);
+		}
+		else if (c != '\r' && fieldno == column)
+		{
+			appendStringInfoCharMacro(field, c);
+			raw_len++;
+		}
+	}
+
+	if (fieldno < column)
+		ereport(ERROR,
+				(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+				 errmsg("missing data for column %d", column)));
+
+	*isnull = null_marker && raw_len == 2;
+	return true;
+}
+
+/*
+ * Check that a field of a text or CSV file is valid in the database
+ * encoding, as COPY FROM does, before it goes to the type's input function.
+ * Fields of ASCII bytes other than NUL always are.
+ */
+static void
+median_file_verify_field(StringInfo field)
+{
+	int			i;
+
+	for (i = 0; i < field->len; i++)
+	{
+		if (field->data[i] == '\0' || IS_HIGHBIT_SET(field->data[i]))
+		{
+			(void) pg_verifymbstr(field->data, field->len, false);
+			return;
+		}
+	}
+}
+
+/*
+ * Read a row of a CSV file, which may span several lines within quotes.
+ * An unquoted empty field is NULL.
+ */
+static bool
+median_file_csv_row(MedianFileReader *reader, int column, StringInfo field,
+					bool *isnull)
+{
+	int			fieldno = 1;
+	bool		in_quotes = false;
+	bool		quoted = false;
+	int			c = median_file_getc(reader);
+
+	if (c == EOF)
+		return false;
+
+	resetStringInfo(field);
+	for (;;)
+	{
+		if (in_quotes)
+		{
+			if (c == EOF)
+				ereport(ERROR,
+						(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+						 errmsg("unterminated CSV quoted field")));
+			if (c == '"')
+			{
+				/* A doubled quote is a literal one, anything else ends the quotes */
+				c = median_file_getc(reader);
+				if (c != '"')
+				{
+					in_quotes = false;
+					continue;
+				}
+			}
+			if (fieldno == column)
+				appendStringInfoCharMacro(field, c);
+		}
+		else if (c == EOF || c == '\n')
+			break;
+		else if (c == '"')
+		{
+			in_quotes = true;
+			if (fieldno == column)
+				quoted = true;
+		}
+		else if (c == ',')
+			fieldno++;
+		else if (c != '\r' && fieldno == column)
+			appendStringInfoCharMacro(field, c);
+
+		c = median_file_getc(reader);
+	}
+
+	if (fieldno < column)
+		ereport(ERROR,
+				(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+				 errmsg("missing data for column %d", column)));
+	*isnull = field->len == 0 && !quoted;
+	return true;
+}
+
+/*
+ * Read a tuple of a binary file, collecting the field of the given column.
+ * Returns false at the trailer.
+ */
+static bool
+median_file_binary_row(MedianFileReader *reader, int column, StringInfo field,
+					   bool *isnull)
+{
+	uint16		nfields;
+	int			fieldno;
+
+	median_file_read(reader, (char *) &nfields, sizeof(nfields));
+	nfields = pg_ntoh16(nfields);
+	if ((int16) nfields == -1)
+		return false;
+	if ((int16) nfields < column)
+		ereport(ERROR,
+				(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+				 errmsg("missing data for column %d", column)));
+
+	resetStringInfo(field);
+	*isnull = true;
+	for (fieldno = 1; fieldno <= (int16) nfields; fieldno++)
+	{
+		int32		len = median_file_read_int32(reader);
+
+		if (len == -1)
+			continue;
+		if (len < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+					 errmsg("invalid field size")));
+
+		if (fieldno == column)
+		{
+			enlargeStringInfo(field, len);
+			median_file_read(reader, field->data, len);
+			field->len = len;
+			field->data[len] = '\0';
+			*isnull = false;
+		}
+		else
+			median_file_read(reader, NULL, len);
+	}
+	return true;
+}
+
+static void
+median_file_error_callback(void *arg)
+{
+	MedianFileReader *reader = (MedianFileReader *) arg;
+
+	if (reader->row > 0)
+		errcontext("median_from_file \"%s\", row " INT64_FORMAT,
+				   reader->path, reader->row);
+}
+
+/*
+ * median_from_file(path text, column_index int4, format text, header bool)
+ * returns float8.
+ */
+Datum
+median_from_file(PG_FUNCTION_ARGS)
+{
+	Datum		result;
+	bool		isnull;
+
+	result = median_from_file_common(fcinfo, FLOAT8OID, PG_GETARG_BOOL(3), &isnull);
+	if (isnull)
+		PG_RETURN_NULL();
+	PG_RETURN_DATUM(result);
+}
+
+/*
+ * median_from_file(path text, column_index int4, format text, type
+ * anyelement, header bool) returns anyelement. The fourth argument only
+ * gives the type of the values, as in median_from_file(..., NULL::int8).
+ */
+Datum
+median_from_file_typed(PG_FUNCTION_ARGS)
+{
+	Datum		result;
+	bool		isnull;
+	int			i;
+
+	for (i = 0; i < PG_NARGS(); i++)
+		if (i != 3 && PG_ARGISNULL(i))
+			PG_RETURN_NULL();
+
+	result = median_from_file_common(fcinfo, get_fn_expr_argtype(fcinfo->flinfo, 3),
+									 PG_GETARG_BOOL(4), &isnull);
+	if (isnull)
+		PG_RETURN_NULL();
+	PG_RETURN_DATUM(result);
+}
+
+static Datum
+median_from_file_common(FunctionCallInfo fcinfo, Oid typid, bool header, bool *isnull)
+{
+	char	   *path = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	int32		column = PG_GETARG_INT32(1);
+	char	   *format_name = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	MedianFileFormat format;
+	MedianFileReader reader;
+	ErrorContextCallback errcallback;
+	MedianState *state;
+	MemoryContext row_context;
+	StringInfoData field;
+	FmgrInfo	flinfo;
+	Oid			typfunc;
+	Oid			typioparam;
+	Datum		result;
+
+	if (!has_privs_of_role(GetUserId(), ROLE_PG_READ_SERVER_FILES))
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("must be superuser or have privileges of the pg_read_server_files role to read files")));
+
+	if (pg_strcasecmp(format_name, "text") == 0)
+		format = MEDIAN_FILE_TEXT;
+	else if (pg_strcasecmp(format_name, "csv") == 0)
+		format = MEDIAN_FILE_CSV;
+	else if (pg_strcasecmp(format_name, "binary") == 0)
+		format = MEDIAN_FILE_BINARY;
+	else
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("file format \"%s\" not recognized", format_name),
+				 errhint("Valid formats are \"text\", \"csv\" and \"binary\".")));
+
+	if (column < 1)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("column index %d is out of range", column)));
+	if (header && format == MEDIAN_FILE_BINARY)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("cannot skip a header in binary format")));
+
+	if (format == MEDIAN_FILE_BINARY)
+		getTypeBinaryInputInfo(typid, &typfunc, &typioparam);
+	else
+		getTypeInputInfo(typid, &typfunc, &typioparam);
+	fmgr_info(typfunc, &flinfo);
+
+	state = median_state_create(CurrentMemoryContext, typid, PG_GET_COLLATION(),
+								false, false);
+	row_context = AllocSetContextCreate(CurrentMemoryContext, "median_from_file row",
+										ALLOCSET_DEFAULT_SIZES);
+	initStringInfo(&field);
+
+	reader.path = path;
+	reader.buf = palloc(MEDIAN_FILE_BUFFER_SIZE);
+	reader.len = 0;
+	reader.pos = 0;
+	reader.row = 0;
+	reader.file = AllocateFile(path, PG_BINARY_R);
+	if (reader.file == NULL)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\" for reading: %m", path)));
+
+	errcallback.callback = median_file_error_callback;
+	errcallback.arg = &reader;
+	errcallback.previous = error_context_stack;
+	error_context_stack = &errcallback;
+
+	if (format == MEDIAN_FILE_BINARY)
+	{
+		char		signature[sizeof(median_file_binary_signature)];
+		int32		extension_len;
+
+		median_file_read(&reader, signature, sizeof(signature));
+		if (memcmp(signature, median_file_binary_signature, sizeof(signature)) != 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+					 errmsg("file \"%s\" is not a binary COPY file", path)));
+		median_file_read_int32(&reader);	/* flags */
+		extension_len = median_file_read_int32(&reader);
+		if (extension_len < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_BAD_COPY_FILE_FORMAT),
+					 errmsg("invalid binary COPY file header")));
+		median_file_read(&reader, NULL, extension_len);
+	}
+
+	for (;;)
+	{
+		bool		more;
+		bool		field_isnull;
+		MemoryContext old_context;
+		Datum		value;
+
+		reader.row++;
+		if (format == MEDIAN_FILE_TEXT)
+			more = median_file_text_row(&reader, column, &field, &field_isnull);
+		else if (format == MEDIAN_FILE_CSV)
+			more = median_file_csv_row(&reader, column, &field, &field_isnull);
+		else
+			more = median_file_binary_row(&reader, column, &field, &field_isnull);
+		if (!more)
+			break;
+		if (field_isnull || (header && reader.row == 1))
+			continue;
+
+		/* Conversion garbage goes with the row, the kernel copies the value */
+		old_context = MemoryContextSwitchTo(row_context);
+		if (format == MEDIAN_FILE_BINARY)
+		{
+			field.cursor = 0;
+			value = ReceiveFunctionCall(&flinfo, &field, typioparam, -1);
+			if (field.cursor != field.len)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+						 errmsg("incorrect binary data format")));
+		}
+		else
+		{
+			median_file_verify_field(&field);
+			value = InputFunctionCall(&flinfo, field.data, typioparam, -1);
+		}
+		MemoryContextSwitchTo(old_context);
+
+		state->kernel->ingest(state, value);
+		MemoryContextReset(row_context);
+	}
+
+	error_context_stack = errcallback.previous;
+	FreeFile(reader.file);
+
+	*isnull = state->num_vals == 0;
+	if (*isnull)
+		return (Datum) 0;
+
+	result = median_state_select(state, state->num_vals / 2);
+	if (!state->typbyval)
+		result = datumCopy(result, false, state->typlen);
+	return result;
+}
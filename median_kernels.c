@@ -0,0 +1,316 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <lib/stringinfo.h>
+#include <libpq/pqformat.h>
+#include <nodes/execnodes.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/float.h>
+#include <utils/lsyscache.h>
+#include <utils/typcache.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+#include "median_networks.h"
+
+/*
+ * Instantiations of the median kernels.
+ *
+ * Native kernels compare with plain operators (or the NaN-aware float
+ * comparisons, which sort NaN above everything else like the btree opclass
+ * does). All other types share the generic kernel, which buffers Datums and
+ * compares through the type's sort support.
+ */
+
+#define MEDIAN_INITIAL_CAPACITY 64
+
+#define MK_PREFIX median_int8
+#define MK_TYPE int64
+#define MK_FROM_DATUM(d) DatumGetInt64(d)
+#define MK_TO_DATUM(x) Int64GetDatum(x)
+#define MK_LT(state, a, b) ((a) < (b))
+#include "median_kernels.h"
+
+#define MK_PREFIX median_int4
+#define MK_TYPE int32
+#define MK_FROM_DATUM(d) DatumGetInt32(d)
+#define MK_TO_DATUM(x) Int32GetDatum(x)
+#define MK_LT(state, a, b) ((a) < (b))
+#include "median_kernels.h"
+
+#define MK_PREFIX median_int2
+#define MK_TYPE int16
+#define MK_FROM_DATUM(d) DatumGetInt16(d)
+#define MK_TO_DATUM(x) Int16GetDatum(x)
+#define MK_LT(state, a, b) ((a) < (b))
+#include "median_kernels.h"
+
+#define MK_PREFIX median_float4
+#define MK_TYPE float4
+#define MK_FROM_DATUM(d) DatumGetFloat4(d)
+#define MK_TO_DATUM(x) Float4GetDatum(x)
+#define MK_LT(state, a, b) float4_lt(a, b)
+#include "median_kernels.h"
+
+#define MK_PREFIX median_float8
+#define MK_TYPE float8
+#define MK_FROM_DATUM(d) DatumGetFloat8(d)
+#define MK_TO_DATUM(x) Float8GetDatum(x)
+#define MK_LT(state, a, b) float8_lt(a, b)
+#include "median_kernels.h"
+
+#define MK_PREFIX median_datum
+#define MK_TYPE Datum
+#define MK_FROM_DATUM(d) (d)
+#define MK_TO_DATUM(x) (x)
+#define MK_LT(state, a, b) (ApplySortComparator(a, false, b, false, (state)->ssup) < 0)
+#define MK_GENERIC
+#include "median_kernels.h"
+
+/*
+ * Pick the kernel for a type. Types with the same binary representation and
+ * ordering share a native kernel.
+ */
+static const MedianKernel *
+median_kernel_lookup(Oid typid)
+{
+	switch (typid)
+	{
+		case INT8OID:
+		case TIMESTAMPOID:
+		case TIMESTAMPTZOID:
+			return &median_int8_kernel;
+		case INT4OID:
+		case DATEOID:
+			return &median_int4_kernel;
+		case INT2OID:
+			return &median_int2_kernel;
+		case FLOAT4OID:
+			return &median_float4_kernel;
+		case FLOAT8OID:
+			return &median_float8_kernel;
+		default:
+			return &median_datum_kernel;
+	}
+}
+
+/*
+ * Whether the Agg node calling an aggregate function hashes its groups (for
+ * some grouping sets, at least), so that the states of many groups are alive
+ * at once.
+ */
+bool
+median_agg_hashed(FunctionCallInfo fcinfo)
+{
+	AggState   *aggstate;
+
+	if (fcinfo->context == NULL || !IsA(fcinfo->context, AggState))
+		return false;
+
+	aggstate = (AggState *) fcinfo->context;
+	return aggstate->aggstrategy != AGG_PLAIN && aggstate->aggstrategy != AGG_SORTED;
+}
+
+/*
+ * Create an empty state for values of the given type in agg_context.
+ *
+ * By-reference values are copied into a context of their own, except for
+ * states of moving window aggregates, which have values removed again and
+ * keep them where they can be freed individually, and for hashed
+ * aggregation (see median_agg_hashed()), where a context per group would
+ * cost at least a block per group. Both allocate them in agg_context.
+ */
+MedianState *
+median_state_create(MemoryContext agg_context, Oid typid, Oid collation,
+					bool moving, bool hashed)
+{
+	MedianState *state;
+
+	state = (MedianState *) MemoryContextAllocZero(agg_context, sizeof(MedianState));
+	state->kernel = median_kernel_lookup(typid);
+	state->agg_context = agg_context;
+	state->moving = moving;
+	state->typid = typid;
+	state->collation = collation;
+	get_typlenbyval(typid, &state->typlen, &state->typbyval);
+
+	if (!state->typbyval)
+		state->value_context = (moving || hashed) ? agg_context :
+			median_value_context_create(agg_context);
+
+	if (state->kernel == &median_datum_kernel)
+	{
+		TypeCacheEntry *typentry = lookup_type_cache(typid, TYPECACHE_LT_OPR);
+
+		if (!OidIsValid(typentry->lt_opr))
+			ereport(ERROR,
+					(errcode(ERRCODE_UNDEFINED_FUNCTION),
+					 errmsg("could not identify an ordering operator for type %s",
+							format_type_be(typid))));
+
+		state->ssup = (SortSupport) MemoryContextAllocZero(agg_context, sizeof(SortSupportData));
+		state->ssup->ssup_cxt = agg_context;
+		state->ssup->ssup_collation = collation;
+		state->ssup->ssup_nulls_first = false;
+		PrepareSortSupportFromOrderingOp(typentry->lt_opr, state->ssup);
+	}
+
+	return state;
+}
+
+/*
+ * Take over a buffer kept across groups as the (still empty) value buffer.
+ * The state then grows the buffer in its own context, so that it outlives
+ * the group.
+ */
+void
+median_state_use_buffer(MedianState *state, MedianBuffer *buffer)
+{
+	Assert(state->vals == NULL && state->num_vals == 0);
+
+	state->buffer = buffer;
+	state->vals = buffer->vals;
+	state->capacity = buffer->size / state->kernel->elem_size;
+}
+
+/*
+ * Grow the value buffer to hold at least min_capacity values, doubling it
+ * to keep appends amortized constant time.
+ */
+void
+median_state_grow(MedianState *state, int64 min_capacity)
+{
+	int64		capacity = state->capacity > 0 ? state->capacity : MEDIAN_INITIAL_CAPACITY;
+	Size		elem_size = state->kernel->elem_size;
+
+	while (capacity < min_capacity)
+		capacity *= 2;
+	if (capacity == state->capacity)
+		return;
+
+	if ((Size) capacity > MaxAllocHugeSize / elem_size)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many values for median aggregate")));
+
+	if (state->vals == NULL)
+		state->vals = MemoryContextAllocHuge(state->buffer ? state->buffer->context :
+											 state->agg_context,
+											 capacity * elem_size);
+	else
+		state->vals = repalloc_huge(state->vals, capacity * elem_size);
+	state->capacity = capacity;
+
+	if (state->buffer)
+	{
+		state->buffer->vals = state->vals;
+		state->buffer->size = capacity * elem_size;
+	}
+}
+
+/*
+ * Return the value of rank k (0-based) among the buffered values.
+ */
+Datum
+median_state_select(MedianState *state, int64 k)
+{
+	Assert(k >= 0 && k < state->num_vals);
+
+	state->kernel->select(state, 0, state->num_vals, k);
+	return state->kernel->fetch(state, k);
+}
+
+/* qsort_arg comparator ordering positions of a rank array by rank */
+static int
+median_rank_cmp(const void *a, const void *b, void *arg)
+{
+	const int64 *ranks = (const int64 *) arg;
+	int64		ra = ranks[*(const int *) a];
+	int64		rb = ranks[*(const int *) b];
+
+	return (ra > rb) - (ra < rb);
+}
+
+/*
+ * Return the values of several ranks (0-based, in any order) at once.
+ *
+ * Ranks are selected in ascending order. Each selection leaves everything
+ * above its rank to the right of it, so the next one only has to look at
+ * that part of the buffer. By-reference results point into the state.
+ */
+void
+median_state_select_ranks(MedianState *state, const int64 *ranks, int nranks,
+						  Datum *values)
+{
+	int		   *order = (int *) palloc(nranks * sizeof(int));
+	int64		lo = 0;
+	int			i;
+
+	for (i = 0; i < nranks; i++)
+		order[i] = i;
+	qsort_arg(order, nranks, sizeof(int), median_rank_cmp, (void *) ranks);
+
+	for (i = 0; i < nranks; i++)
+	{
+		int64		k = ranks[order[i]];
+
+		Assert(k >= 0 && k < state->num_vals);
+
+		if (i > 0 && k == ranks[order[i - 1]])
+		{
+			values[order[i]] = values[order[i - 1]];
+			continue;
+		}
+		state->kernel->select(state, lo, state->num_vals, k);
+		values[order[i]] = state->kernel->fetch(state, k);
+		lo = k + 1;
+	}
+
+	pfree(order);
+}
+
+/*
+ * Empty a state for reuse, as median_of() does for every row. By-reference
+ * values copied into the state are released.
+ */
+void
+median_state_reset(MedianState *state)
+{
+	Assert(!state->moving && state->input_order == MEDIAN_INPUT_UNORDERED);
+
+	state->num_vals = 0;
+	if (state->value_context != NULL)
+		MemoryContextReset(state->value_context);
+}
+
+/*
+ * Add a value of sorted input.
+ *
+ * The median of the final m values has rank m / 2 (ascending input) or
+ * (m - 1) / 2 (descending input) in the order of arrival. Since m only
+ * grows, anything arriving before that rank in the values seen so far can
+ * never become the median, so it is dropped from the head of the ring as
+ * soon as it falls behind. The head of the ring is then always the median
+ * of the values seen so far, and only about half of them are kept.
+ */
+void
+median_state_push_sorted(MedianState *state, Datum value)
+{
+	int64		total;
+	int64		median_rank;
+
+	Assert(state->input_order != MEDIAN_INPUT_UNORDERED);
+
+	state->kernel->ring_push(state, value);
+
+	total = state->num_dropped + state->num_vals;
+	median_rank = state->input_order == MEDIAN_INPUT_ASCENDING ?
+		total / 2 : (total - 1) / 2;
+
+	while (state->num_dropped < median_rank)
+	{
+		state->ring_head = (state->ring_head + 1) % state->capacity;
+		state->num_vals--;
+		state->num_dropped++;
+	}
+}
@@ -0,0 +1,527 @@
+/*
+ * Template for the type-specialized median kernels.
+ *
+ * Each inclusion generates the routines of one MedianKernel, in the style of
+ * lib/simplehash.h and lib/sort_template.h. Parameters:
+ *
+ *	  - MK_PREFIX - prefix for all generated names, e.g. median_int8
+ *	  - MK_TYPE - C type of the buffered elements
+ *	  - MK_FROM_DATUM(d), MK_TO_DATUM(x) - conversion between Datum and MK_TYPE
+ *	  - MK_LT(state, a, b) - true if a sorts before b
+ *	  - MK_GENERIC - define for the kernel that buffers plain Datums of any
+ *		type; by-reference values are then copied into state->value_context
+ *
+ * The kernel itself is defined as MK_PREFIX_kernel. All parameters are
+ * undefined at the end of the file so it can be included again.
+ */
+
+#define MK_MAKE_PREFIX(a) CppConcat(a,_)
+#define MK_MAKE_NAME(name) MK_MAKE_NAME_(MK_MAKE_PREFIX(MK_PREFIX),name)
+#define MK_MAKE_NAME_(a,b) CppConcat(a,b)
+
+#define MK_INGEST		MK_MAKE_NAME(ingest)
+#define MK_SELECT		MK_MAKE_NAME(select)
+#define MK_MOM_PIVOT	MK_MAKE_NAME(mom_pivot)
+#define MK_SORT			MK_MAKE_NAME(sort)
+#define MK_CMP			MK_MAKE_NAME(cmp)
+#define MK_FETCH		MK_MAKE_NAME(fetch)
+#define MK_MERGE		MK_MAKE_NAME(merge)
+#define MK_SERIALIZE	MK_MAKE_NAME(serialize)
+#define MK_DESERIALIZE	MK_MAKE_NAME(deserialize)
+#define MK_REMOVE		MK_MAKE_NAME(remove)
+#define MK_RING_PUSH	MK_MAKE_NAME(ring_push)
+#define MK_LOWER_BOUND	MK_MAKE_NAME(lower_bound)
+#define MK_COPY			MK_MAKE_NAME(copy)
+#define MK_NETWORK_SORT	MK_MAKE_NAME(network_sort)
+#define MK_NETWORK_MEDIAN	MK_MAKE_NAME(network_median)
+#define MK_KERNEL		MK_MAKE_NAME(kernel)
+
+/* Smallest range partitioned around the median of medians */
+#define MK_MOM_MIN_SIZE 15
+
+#define MK_SWAP(a, b) \
+	do { \
+		MK_TYPE		mk_swap_tmp_ = (a); \
+		(a) = (b); \
+		(b) = mk_swap_tmp_; \
+	} while (0)
+
+/*
+ * Make a value safe to keep in the buffer. Only by-reference values of the
+ * generic kernel need copying; toasted ones are detoasted on the way so that
+ * comparisons do not have to.
+ *
+ * Detoasting frees intermediate copies, which the bump context holding the
+ * values does not allow, so it happens in the caller's context and only the
+ * result is copied over.
+ */
+static inline MK_TYPE
+MK_COPY(MedianState *state, Datum value)
+{
+#ifdef MK_GENERIC
+	if (!state->typbyval)
+	{
+		struct varlena *detoasted = NULL;
+		MemoryContext old_context;
+
+		if (state->typlen == -1)
+		{
+			detoasted = PG_DETOAST_DATUM_PACKED(value);
+			if (detoasted == (struct varlena *) DatumGetPointer(value))
+				detoasted = NULL;
+		}
+
+		old_context = MemoryContextSwitchTo(state->value_context);
+		value = datumCopy(detoasted ? PointerGetDatum(detoasted) : value, false,
+						  state->typlen);
+		MemoryContextSwitchTo(old_context);
+
+		if (detoasted)
+			pfree(detoasted);
+	}
+#endif
+	return MK_FROM_DATUM(value);
+}
+
+static void
+MK_INGEST(MedianState *state, Datum value)
+{
+	if (unlikely(state->num_vals >= state->capacity))
+		median_state_grow(state, state->num_vals + 1);
+	((MK_TYPE *) state->vals)[state->num_vals++] = MK_COPY(state, value);
+}
+
+/*
+ * Move the median of medians of groups of five in the inclusive range
+ * [l, r] to v[l + 1], with a value sorting before or equal to it in v[l] and
+ * one sorting after or equal to it in v[r], as MK_SELECT's partitioning step
+ * expects. At least 3/10 of the range sorts on either side of this pivot,
+ * whatever the input. The range must hold at least MK_MOM_MIN_SIZE values.
+ */
+static void MK_SELECT(MedianState *state, int64 lo, int64 hi, int64 k);
+
+static void
+MK_MOM_PIVOT(MedianState *state, int64 l, int64 r)
+{
+	MK_TYPE    *v = (MK_TYPE *) state->vals;
+	int64		ngroups = (r - l + 1) / 5;
+	int64		g;
+
+	Assert(r - l + 1 >= MK_MOM_MIN_SIZE);
+
+	/* Insertion sort each group and gather its median at v[l + g] */
+	for (g = 0; g < ngroups; g++)
+	{
+		MK_TYPE    *group = v + l + 5 * g;
+		int			i;
+		int			j;
+
+		for (i = 1; i < 5; i++)
+			for (j = i; j > 0 && MK_LT(state, group[j], group[j - 1]); j--)
+				MK_SWAP(group[j], group[j - 1]);
+		MK_SWAP(v[l + g], group[2]);
+	}
+
+	/*
+	 * Select the median of the medians. This leaves smaller medians before
+	 * it and larger ones after it, which provide the sentinels.
+	 */
+	MK_SELECT(state, l, l + ngroups, l + ngroups / 2);
+	MK_SWAP(v[l + 1], v[l + ngroups / 2]);
+	MK_SWAP(v[r], v[l + ngroups - 1]);
+}
+
+/*
+ * Introselect on the inclusive range [lo, hi - 1]. On return, vals[k] holds
+ * the value of rank k within the range, everything before it sorts before or
+ * equal to it and everything after it sorts after or equal to it.
+ *
+ * Pivots are normally the median of three values, which is fast on
+ * real-world data. Crafted input can defeat that choice and make every
+ * partitioning step shed only a few values, so whenever three steps in a row
+ * fail to halve the range, the next pivot is the median of medians instead.
+ * The range then shrinks geometrically and selection stays linear in the
+ * worst case.
+ */
+static void
+MK_SELECT(MedianState *state, int64 lo, int64 hi, int64 k)
+{
+	MK_TYPE    *v = (MK_TYPE *) state->vals;
+	int64		l = lo;
+	int64		r = hi - 1;
+	int64		checkpoint = hi - lo;
+	int			slow_steps = 0;
+
+	Assert(lo <= k && k < hi);
+
+	for (;;)
+	{
+		int64		i;
+		int64		j;
+		MK_TYPE		pivot;
+
+		if (r <= l + 1)
+		{
+			if (r == l + 1 && MK_LT(state, v[r], v[l]))
+				MK_SWAP(v[l], v[r]);
+			return;
+		}
+
+		if (2 * (r - l + 1) <= checkpoint)
+		{
+			checkpoint = r - l + 1;
+			slow_steps = 0;
+		}
+
+		if (slow_steps >= 3 && r - l + 1 >= MK_MOM_MIN_SIZE)
+			MK_MOM_PIVOT(state, l, r);
+		else
+		{
+			/* Order v[l] <= v[l + 1] <= v[r], with the middle element as pivot */
+			int64		mid = l + (r - l) / 2;
+
+			MK_SWAP(v[mid], v[l + 1]);
+			if (MK_LT(state, v[r], v[l]))
+				MK_SWAP(v[l], v[r]);
+			if (MK_LT(state, v[r], v[l + 1]))
+				MK_SWAP(v[l + 1], v[r]);
+			if (MK_LT(state, v[l + 1], v[l]))
+				MK_SWAP(v[l], v[l + 1]);
+		}
+		slow_steps++;
+
+		/* Partition around the pivot; v[l] and v[r] act as sentinels */
+		i = l + 1;
+		j = r;
+		pivot = v[l + 1];
+		for (;;)
+		{
+			do
+				i++;
+			while (MK_LT(state, v[i], pivot));
+			do
+				j--;
+			while (MK_LT(state, pivot, v[j]));
+			if (j < i)
+				break;
+			MK_SWAP(v[i], v[j]);
+		}
+		v[l + 1] = v[j];
+		v[j] = pivot;
+
+		/* Continue in the part that contains k */
+		if (j >= k)
+			r = j - 1;
+		if (j <= k)
+			l = i;
+	}
+}
+
+static int
+MK_CMP(const MK_TYPE *a, const MK_TYPE *b, MedianState *state)
+{
+	if (MK_LT(state, *a, *b))
+		return -1;
+	if (MK_LT(state, *b, *a))
+		return 1;
+	return 0;
+}
+
+#ifdef MEDIAN_HAVE_SORT_TEMPLATE
+#define ST_SORT MK_MAKE_NAME(sort_internal)
+#define ST_ELEMENT_TYPE MK_TYPE
+#define ST_COMPARE(a, b, arg) MK_CMP(a, b, arg)
+#define ST_COMPARE_ARG_TYPE MedianState
+#define ST_SCOPE static
+#define ST_DEFINE
+#include <lib/sort_template.h>
+
+static void
+MK_SORT(MedianState *state)
+{
+	MK_MAKE_NAME(sort_internal) ((MK_TYPE *) state->vals, state->num_vals, state);
+}
+#else
+static int
+MK_MAKE_NAME(qsort_cmp) (const void *a, const void *b, void *arg)
+{
+	return MK_CMP((const MK_TYPE *) a, (const MK_TYPE *) b, (MedianState *) arg);
+}
+
+static void
+MK_SORT(MedianState *state)
+{
+	qsort_arg(state->vals, state->num_vals, sizeof(MK_TYPE),
+			  MK_MAKE_NAME(qsort_cmp), state);
+}
+#endif
+
+static Datum
+MK_FETCH(const MedianState *state, int64 i)
+{
+	Assert(i >= 0 && i < state->capacity);
+	return MK_TO_DATUM(((const MK_TYPE *) state->vals)[i]);
+}
+
+static void
+MK_MERGE(MedianState *dst, const MedianState *src)
+{
+	const MK_TYPE *sv = (const MK_TYPE *) src->vals;
+	MK_TYPE    *dv;
+	int64		i;
+
+	if (src->num_vals == 0)
+		return;
+	if (dst->num_vals + src->num_vals > dst->capacity)
+		median_state_grow(dst, dst->num_vals + src->num_vals);
+
+	dv = (MK_TYPE *) dst->vals + dst->num_vals;
+#ifdef MK_GENERIC
+	for (i = 0; i < src->num_vals; i++)
+		dv[i] = MK_COPY(dst, sv[i]);
+#else
+	(void) i;
+	memcpy(dv, sv, src->num_vals * sizeof(MK_TYPE));
+#endif
+	dst->num_vals += src->num_vals;
+}
+
+/*
+ * The serialized form only ever travels between processes of the same
+ * server, so native values are written in memory layout.
+ */
+static void
+MK_SERIALIZE(const MedianState *state, StringInfo buf)
+{
+#ifdef MK_GENERIC
+	const Datum *v = (const Datum *) state->vals;
+	int64		i;
+
+	for (i = 0; i < state->num_vals; i++)
+	{
+		if (state->typbyval)
+			appendBinaryStringInfo(buf, (const char *) &v[i], sizeof(Datum));
+		else
+		{
+			Size		size = datumGetSize(v[i], false, state->typlen);
+
+			pq_sendint32(buf, (uint32) size);
+			appendBinaryStringInfo(buf, DatumGetPointer(v[i]), size);
+		}
+	}
+#else
+	appendBinaryStringInfo(buf, (const char *) state->vals,
+						   state->num_vals * sizeof(MK_TYPE));
+#endif
+}
+
+static void
+MK_DESERIALIZE(MedianState *state, StringInfo buf, int64 count)
+{
+	MK_TYPE    *v;
+
+	if (state->num_vals + count > state->capacity)
+		median_state_grow(state, state->num_vals + count);
+	v = (MK_TYPE *) state->vals + state->num_vals;
+
+#ifdef MK_GENERIC
+	{
+		int64		i;
+
+		for (i = 0; i < count; i++)
+		{
+			if (state->typbyval)
+				pq_copymsgbytes(buf, (char *) &v[i], sizeof(Datum));
+			else
+			{
+				Size		size = pq_getmsgint(buf, 4);
+				char	   *value = MemoryContextAlloc(state->value_context, size);
+
+				pq_copymsgbytes(buf, value, size);
+				v[i] = PointerGetDatum(value);
+			}
+		}
+	}
+#else
+	pq_copymsgbytes(buf, (char *) v, count * sizeof(MK_TYPE));
+#endif
+	state->num_vals += count;
+}
+
+/*
+ * Remove one occurrence of value, for the inverse transition function of
+ * moving window frames. The last value takes its place; the buffer is
+ * unordered anyway.
+ */
+static bool
+MK_REMOVE(MedianState *state, Datum value)
+{
+	MK_TYPE    *v = (MK_TYPE *) state->vals;
+	MK_TYPE		x = MK_FROM_DATUM(value);
+	int64		i;
+
+	for (i = 0; i < state->num_vals; i++)
+	{
+		if (!MK_LT(state, v[i], x) && !MK_LT(state, x, v[i]))
+		{
+#ifdef MK_GENERIC
+			if (!state->typbyval && state->moving)
+				pfree(DatumGetPointer(v[i]));
+#endif
+			v[i] = v[--state->num_vals];
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Append a value to the ring buffer used for sorted input. When the ring is
+ * full it is grown and the part that wrapped around to the start of the
+ * buffer moved behind the old end, so that it is contiguous again.
+ */
+static void
+MK_RING_PUSH(MedianState *state, Datum value)
+{
+	MK_TYPE    *v;
+
+	if (unlikely(state->num_vals >= state->capacity))
+	{
+		int64		old_capacity = state->capacity;
+
+		median_state_grow(state, state->num_vals + 1);
+		v = (MK_TYPE *) state->vals;
+		memcpy(v + old_capacity, v, state->ring_head * sizeof(MK_TYPE));
+	}
+
+	v = (MK_TYPE *) state->vals;
+	v[(state->ring_head + state->num_vals) % state->capacity] = MK_COPY(state, value);
+	state->num_vals++;
+}
+
+/*
+ * Count the values below the given one in the sorted buffer, by binary
+ * search.
+ */
+static int64
+MK_LOWER_BOUND(MedianState *state, Datum value)
+{
+	MK_TYPE    *v = (MK_TYPE *) state->vals;
+	MK_TYPE		x = MK_FROM_DATUM(value);
+	int64		lo = 0;
+	int64		hi = state->num_vals;
+
+	while (lo < hi)
+	{
+		int64		mid = lo + (hi - lo) / 2;
+
+		if (MK_LT(state, v[mid], x))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Sort v[] with a sorting network given as pairs of positions. Each
+ * compare-exchange selects the smaller and larger value instead of
+ * branching, and with a constant network the loop unrolls into straight-line
+ * code.
+ */
+static pg_attribute_always_inline void
+MK_NETWORK_SORT(MedianState *state, MK_TYPE *v, const uint8 (*pairs)[2], int npairs)
+{
+	int			i;
+
+	for (i = 0; i < npairs; i++)
+	{
+		MK_TYPE		a = v[pairs[i][0]];
+		MK_TYPE		b = v[pairs[i][1]];
+		bool		swap = MK_LT(state, b, a);
+
+		v[pairs[i][0]] = swap ? b : a;
+		v[pairs[i][1]] = swap ? a : b;
+	}
+}
+
+#define MK_NETWORK_CASE(n) \
+	case n: \
+		MK_NETWORK_SORT(state, v, median_network_##n, lengthof(median_network_##n)); \
+		break
+
+/*
+ * Return the value of rank n / 2 among a few values, which need not be in a
+ * buffer. There is a separately unrolled network for every count, so short
+ * rows take no loops or calls at all.
+ */
+static Datum
+MK_NETWORK_MEDIAN(MedianState *state, Datum *values, int n)
+{
+	MK_TYPE		v[MEDIAN_NETWORK_MAX];
+	int			i;
+
+	Assert(n >= 1 && n <= MEDIAN_NETWORK_MAX);
+
+	for (i = 0; i < n; i++)
+		v[i] = MK_FROM_DATUM(values[i]);
+
+	switch (n)
+	{
+		MK_NETWORK_CASE(2);
+		MK_NETWORK_CASE(3);
+		MK_NETWORK_CASE(4);
+		MK_NETWORK_CASE(5);
+		MK_NETWORK_CASE(6);
+		MK_NETWORK_CASE(7);
+		MK_NETWORK_CASE(8);
+		MK_NETWORK_CASE(9);
+	}
+
+	return MK_TO_DATUM(v[n / 2]);
+}
+
+static const MedianKernel MK_KERNEL = {
+	CppAsString2(MK_PREFIX),
+	sizeof(MK_TYPE),
+	MK_INGEST,
+	MK_SELECT,
+	MK_SORT,
+	MK_FETCH,
+	MK_MERGE,
+	MK_SERIALIZE,
+	MK_DESERIALIZE,
+	MK_REMOVE,
+	MK_RING_PUSH,
+	MK_NETWORK_MEDIAN,
+	MK_LOWER_BOUND,
+};
+
+#undef MK_PREFIX
+#undef MK_TYPE
+#undef MK_FROM_DATUM
+#undef MK_TO_DATUM
+#undef MK_LT
+#undef MK_GENERIC
+#undef MK_MAKE_PREFIX
+#undef MK_MAKE_NAME
+#undef MK_MAKE_NAME_
+#undef MK_INGEST
+#undef MK_SELECT
+#undef MK_MOM_PIVOT
+#undef MK_SORT
+#undef MK_CMP
+#undef MK_FETCH
+#undef MK_MERGE
+#undef MK_SERIALIZE
+#undef MK_DESERIALIZE
+#undef MK_REMOVE
+#undef MK_RING_PUSH
+#undef MK_LOWER_BOUND
+#undef MK_COPY
+#undef MK_NETWORK_SORT
+#undef MK_NETWORK_MEDIAN
+#undef MK_NETWORK_CASE
+#undef MK_KERNEL
+#undef MK_SWAP
+#undef MK_MOM_MIN_SIZE
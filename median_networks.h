@@ -0,0 +1,39 @@
+/*
+ * Sorting networks for the median kernels, included by every file that
+ * instantiates median_kernels.h.
+ */
+#ifndef MEDIAN_NETWORKS_H
+#define MEDIAN_NETWORKS_H
+
+#include <postgres.h>
+
+/*
+ * Sorting networks for 2 to MEDIAN_NETWORK_MAX values, as the pairs of
+ * positions to compare and exchange in turn. Each has the fewest known
+ * comparators for its size.
+ */
+static const uint8 median_network_2[][2] = {{0, 1}};
+static const uint8 median_network_3[][2] = {{0, 2}, {0, 1}, {1, 2}};
+static const uint8 median_network_4[][2] = {{0, 2}, {1, 3}, {0, 1}, {2, 3}, {1, 2}};
+static const uint8 median_network_5[][2] = {
+	{0, 3}, {1, 4}, {0, 2}, {1, 3}, {0, 1}, {2, 4}, {1, 2}, {3, 4}, {2, 3}
+};
+static const uint8 median_network_6[][2] = {
+	{0, 5}, {1, 3}, {2, 4}, {1, 2}, {3, 4}, {0, 3}, {2, 5}, {0, 1}, {2, 3}, {4, 5},
+	{1, 2}, {3, 4}
+};
+static const uint8 median_network_7[][2] = {
+	{0, 6}, {2, 3}, {4, 5}, {0, 2}, {1, 4}, {3, 6}, {0, 1}, {2, 5}, {3, 4}, {1, 2},
+	{4, 6}, {2, 3}, {4, 5}, {1, 2}, {3, 4}, {5, 6}
+};
+static const uint8 median_network_8[][2] = {
+	{0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}, {0, 1}, {2, 3},
+	{4, 5}, {6, 7}, {2, 4}, {3, 5}, {1, 4}, {3, 6}, {1, 2}, {3, 4}, {5, 6}
+};
+static const uint8 median_network_9[][2] = {
+	{0, 3}, {1, 7}, {2, 5}, {4, 8}, {0, 7}, {2, 4}, {3, 8}, {5, 6}, {0, 2}, {1, 3},
+	{4, 5}, {7, 8}, {1, 4}, {3, 6}, {5, 7}, {0, 1}, {2, 4}, {3, 5}, {6, 8}, {2, 3},
+	{4, 5}, {6, 7}, {1, 2}, {3, 4}, {5, 6}
+};
+
+#endif							/* MEDIAN_NETWORKS_H */
@@ -0,0 +1,103 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <utils/array.h>
+#include <utils/arrayaccess.h>
+#include <utils/datum.h>
+#include <utils/lsyscache.h>
+
+#include "median.h"
+
+/*
+ * median_of(VARIADIC anyarray): the median of the arguments of a single
+ * call, e.g. of replicated readings stored in several columns of a row.
+ *
+ * Up to MEDIAN_NETWORK_MAX non-NULL values go through a sorting network of
+ * the kernel for their type, on a copy in local variables. Longer rows are
+ * buffered in a state kept across calls and selected from as median() does.
+ * As with median(), NULLs are ignored and the upper one of the two middle
+ * values is returned for an even number of values.
+ */
+
+PG_FUNCTION_INFO_V1(median_of);
+
+/* Per-call-site data, kept in fn_extra */
+typedef struct MedianOfCache
+{
+	Oid			typid;
+	Oid			collation;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	MedianState *state;			/* kernel, comparator and buffer */
+} MedianOfCache;
+
+Datum
+median_of(PG_FUNCTION_ARGS)
+{
+	AnyArrayType *values = PG_GETARG_ANY_ARRAY_P(0);
+	Oid			typid = AARR_ELEMTYPE(values);
+	int			nvalues = ArrayGetNItems(AARR_NDIM(values), AARR_DIMS(values));
+	MedianOfCache *cache = (MedianOfCache *) fcinfo->flinfo->fn_extra;
+	MedianState *state;
+	array_iter	iter;
+	Datum		result;
+	int			i;
+
+	if (cache == NULL || cache->typid != typid ||
+		cache->collation != PG_GET_COLLATION())
+	{
+		cache = (MedianOfCache *) MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+													 sizeof(MedianOfCache));
+		cache->typid = typid;
+		cache->collation = PG_GET_COLLATION();
+		get_typlenbyvalalign(typid, &cache->typlen, &cache->typbyval, &cache->typalign);
+		cache->state = median_state_create(fcinfo->flinfo->fn_mcxt, typid,
+										   cache->collation, false, false);
+		fcinfo->flinfo->fn_extra = cache;
+	}
+	state = cache->state;
+
+	array_iter_setup(&iter, values);
+	if (nvalues <= MEDIAN_NETWORK_MAX)
+	{
+		Datum		row[MEDIAN_NETWORK_MAX];
+		int			n = 0;
+
+		for (i = 0; i < nvalues; i++)
+		{
+			bool		isnull;
+			Datum		value = array_iter_next(&iter, &isnull, i, cache->typlen,
+												cache->typbyval, cache->typalign);
+
+			if (!isnull)
+				row[n++] = value;
+		}
+		if (n == 0)
+			PG_RETURN_NULL();
+
+		result = state->kernel->network_median(state, row, n);
+	}
+	else
+	{
+		median_state_reset(state);
+		for (i = 0; i < nvalues; i++)
+		{
+			bool		isnull;
+			Datum		value = array_iter_next(&iter, &isnull, i, cache->typlen,
+												cache->typbyval, cache->typalign);
+
+			if (!isnull)
+				state->kernel->ingest(state, value);
+		}
+		if (state->num_vals == 0)
+			PG_RETURN_NULL();
+
+		result = median_state_select(state, state->num_vals / 2);
+	}
+
+	/* The result points into the array or the state otherwise */
+	if (!cache->typbyval)
+		result = datumCopy(result, false, cache->typlen);
+
+	PG_RETURN_DATUM(result);
+}
@@ -0,0 +1,548 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <miscadmin.h>
+#include <access/xact.h>
+#include <executor/spi.h>
+#include <lib/stringinfo.h>
+#include <parser/parse_coerce.h>
+#include <pgstat.h>
+#include <postmaster/bgworker.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
+#include <utils/acl.h>
+#include <utils/builtins.h>
+#include <utils/guc.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+#include <utils/resowner.h>
+#include <utils/snapmgr.h>
+#include <utils/timestamp.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+
+/*
+ * Rollups of quantile sketches.
+ *
+ * median_rollup_add() registers a value column of a table, along with its
+ * timestamp column, a bucket width and the registering role, in
+ * median_rollup_config. Callers get no privileges on that table, so that
+ * the role recorded is always one that may read the table.
+ * median_rollup_refresh() then stores a quantile sketch per bucket of the
+ * rows that arrived since the last refresh in median_rollup_data, from which
+ * median_rollup_quantile() answers quantiles over any range of buckets
+ * without reading the table.
+ *
+ * Each configured column has a watermark: everything before it has been
+ * rolled up. A refresh scans only the rows from the watermark up to the
+ * start of the current bucket, which is not complete yet, and moves the
+ * watermark there. Old rows are thus never scanned again; rows that arrive
+ * late, with a timestamp behind the watermark, are not rolled up at all.
+ *
+ * With median.so in shared_preload_libraries, a background worker calls
+ * median_rollup_refresh() every median.rollup_naptime seconds in the
+ * database median.rollup_database.
+ */
+
+#define ROLLUP_WORKER_RESTART_SECS	60
+
+PG_FUNCTION_INFO_V1(median_rollup_add);
+PG_FUNCTION_INFO_V1(median_rollup_refresh);
+PG_FUNCTION_INFO_V1(median_rollup_check_select);
+
+PGDLLEXPORT void median_rollup_worker_main(Datum main_arg) pg_attribute_noreturn();
+
+static int	rollup_naptime = 60;
+static char *rollup_database = NULL;
+
+static volatile sig_atomic_t got_sighup = false;
+static volatile sig_atomic_t got_sigterm = false;
+
+static char *rollup_schema(void);
+static AttrNumber rollup_check_column(Oid relid, const char *relname,
+									  const char *column, Oid target_type);
+
+/*
+ * Return the quoted name of the extension's schema, or NULL if the extension
+ * is not installed. Must be called while connected to SPI.
+ */
+static char *
+rollup_schema(void)
+{
+	bool		isnull;
+	Datum		schema;
+
+	if (SPI_execute("SELECT quote_ident(n.nspname) FROM pg_catalog.pg_extension e "
+					"JOIN pg_catalog.pg_namespace n ON n.oid = e.extnamespace "
+					"WHERE e.extname = 'median'", true, 1) != SPI_OK_SELECT)
+		elog(ERROR, "could not look up the schema of extension \"median\"");
+
+	if (SPI_processed == 0)
+		return NULL;
+	schema = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+	return TextDatumGetCString(schema);
+}
+
+/*
+ * Check that a column exists and can be cast to the target type.
+ */
+static AttrNumber
+rollup_check_column(Oid relid, const char *relname, const char *column,
+					Oid target_type)
+{
+	AttrNumber	attnum = get_attnum(relid, column);
+	Oid			atttype;
+
+	if (attnum == InvalidAttrNumber)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_COLUMN),
+				 errmsg("column \"%s\" of relation \"%s\" does not exist",
+						column, relname)));
+
+	atttype = get_atttype(relid, attnum);
+	if (!can_coerce_type(1, &atttype, &target_type, COERCION_EXPLICIT))
+		ereport(ERROR,
+				(errcode(ERRCODE_DATATYPE_MISMATCH),
+				 errmsg("column \"%s\" of relation \"%s\" cannot be cast to %s",
+						column, relname, format_type_be(target_type))));
+
+	return attnum;
+}
+
+/*
+ * median_rollup_add(relation regclass, ts_column name, val_column name,
+ *					 bucket_width interval)
+ *
+ * Registers a column for rollups and returns the id of its configuration.
+ * The bucket width must not contain months, whose length varies; days count
+ * as 24 hours.
+ */
+Datum
+median_rollup_add(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	Name		ts_column = PG_GETARG_NAME(1);
+	Name		val_column = PG_GETARG_NAME(2);
+	Interval   *width = PG_GETARG_INTERVAL_P(3);
+	char	   *relname = get_rel_name(relid);
+	char	   *schema;
+	StringInfoData query;
+	Oid			argtypes[5] = {REGCLASSOID, NAMEOID, NAMEOID, INTERVALOID, REGROLEOID};
+	Datum		values[5];
+	bool		isnull;
+	int32		id;
+	Oid			config_owner;
+	Oid			save_userid;
+	int			save_sec_context;
+
+	if (relname == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg("relation with OID %u does not exist", relid)));
+
+	if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("permission denied for table %s", relname)));
+
+	rollup_check_column(relid, relname, NameStr(*ts_column), TIMESTAMPTZOID);
+	rollup_check_column(relid, relname, NameStr(*val_column), FLOAT8OID);
+
+	if (width->month != 0 || width->time + (double) width->day * USECS_PER_DAY <= 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("rollup bucket width must be a positive interval without months")));
+
+	SPI_connect();
+
+	schema = rollup_schema();
+	if (schema == NULL)
+		elog(ERROR, "extension \"median\" is not installed");
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT relowner FROM pg_catalog.pg_class "
+					 "WHERE oid = '%s.median_rollup_config'::pg_catalog.regclass", schema);
+	if (SPI_execute(query.data, true, 1) != SPI_OK_SELECT || SPI_processed != 1)
+		elog(ERROR, "could not look up the owner of the rollup configuration");
+	config_owner = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+												  SPI_tuptable->tupdesc, 1, &isnull));
+
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+					 "INSERT INTO %s.median_rollup_config (relid, ts_column, val_column, bucket_width, owner) "
+					 "VALUES ($1, $2, $3, $4, $5) RETURNING id", schema);
+
+	values[0] = ObjectIdGetDatum(relid);
+	values[1] = NameGetDatum(ts_column);
+	values[2] = NameGetDatum(val_column);
+	values[3] = IntervalPGetDatum(width);
+	values[4] = ObjectIdGetDatum(GetUserId());
+
+	/* Insert as the owner of the configuration, like a SECURITY DEFINER function */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(config_owner, save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	if (SPI_execute_with_args(query.data, 5, argtypes, values, NULL, false, 1) != SPI_OK_INSERT_RETURNING)
+		elog(ERROR, "could not insert the rollup configuration");
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	id = DatumGetInt32(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull));
+
+	SPI_finish();
+
+	PG_RETURN_INT32(id);
+}
+
+/*
+ * _median_rollup_check_select(relation regclass)
+ *
+ * Rollups summarize the rows of a table, so reading them takes the SELECT
+ * privilege on it. Raises an error without it and returns true otherwise,
+ * for use as a condition of the queries reading rollups.
+ */
+Datum
+median_rollup_check_select(PG_FUNCTION_ARGS)
+{
+	Oid			relid = PG_GETARG_OID(0);
+	char	   *relname = get_rel_name(relid);
+
+	if (relname == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_TABLE),
+				 errmsg("relation with OID %u does not exist", relid)));
+
+	if (pg_class_aclcheck(relid, GetUserId(), ACL_SELECT) != ACLCHECK_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("permission denied for table %s", relname)));
+
+	PG_RETURN_BOOL(true);
+}
+
+/*
+ * Roll up one configuration, a row of the query in median_rollup_refresh(),
+ * and return the number of buckets written.
+ *
+ * The table is read as the role that registered the rollup, in a
+ * security-restricted operation with a safe search_path as for REFRESH
+ * MATERIALIZED VIEW, so that casts and functions on its columns cannot act
+ * with the privileges of whoever refreshes. The sketches are then stored
+ * as the refreshing role.
+ */
+static int64
+rollup_refresh_one(const char *schema, HeapTuple tuple, TupleDesc tupdesc)
+{
+	bool		isnull;
+	int32		id = DatumGetInt32(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+	Oid			relid = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+	char	   *ts_column = SPI_getvalue(tuple, tupdesc, 3);
+	char	   *val_column = SPI_getvalue(tuple, tupdesc, 4);
+	float8		width = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 5, &isnull));
+	TimestampTz watermark = DatumGetTimestampTz(SPI_getbinval(tuple, tupdesc, 6, &isnull));
+	TimestampTz new_watermark = DatumGetTimestampTz(SPI_getbinval(tuple, tupdesc, 7, &isnull));
+	Oid			owner = DatumGetObjectId(SPI_getbinval(tuple, tupdesc, 8, &isnull));
+	char	   *relname = get_rel_name(relid);
+	StringInfoData query;
+	Oid			argtypes[3] = {INT4OID, TIMESTAMPTZOID, TIMESTAMPTZOID};
+	Datum		values[3];
+	Oid			save_userid;
+	int			save_sec_context;
+	int			save_nestlevel;
+	SPITupleTable *sketches;
+	uint64		nsketches;
+	uint64		i;
+
+	if (relname == NULL)
+	{
+		ereport(WARNING,
+				(errmsg("skipping rollup %d of dropped relation with OID %u", id, relid)));
+		return 0;
+	}
+	if (new_watermark <= watermark)
+		return 0;
+
+	if (GetUserNameFromId(owner, true) == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_UNDEFINED_OBJECT),
+				 errmsg("role with OID %u that registered the rollup does not exist",
+						owner)));
+	if (pg_class_aclcheck(relid, owner, ACL_SELECT) != ACLCHECK_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_PRIVILEGE),
+				 errmsg("permission denied for table %s", relname)));
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT to_timestamp(floor(extract(epoch FROM s.ts) / %.17g) * %.17g), "
+					 "%s.quantile_sketch(s.val) "
+					 "FROM (SELECT %s::timestamptz AS ts, %s::float8 AS val FROM %s) s "
+					 "WHERE s.ts >= $2 AND s.ts < $3 AND isfinite(s.ts) "
+					 "AND s.val > '-Infinity' AND s.val < 'Infinity' "
+					 "GROUP BY 1",
+					 width, width, schema,
+					 quote_identifier(ts_column), quote_identifier(val_column),
+					 quote_qualified_identifier(get_namespace_name(get_rel_namespace(relid)), relname));
+
+	values[0] = Int32GetDatum(id);
+	values[1] = TimestampTzGetDatum(watermark);
+	values[2] = TimestampTzGetDatum(new_watermark);
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(owner, save_sec_context | SECURITY_RESTRICTED_OPERATION);
+	save_nestlevel = NewGUCNestLevel();
+	(void) set_config_option("search_path", "pg_catalog, pg_temp",
+							 PGC_USERSET, PGC_S_SESSION, GUC_ACTION_SAVE,
+							 true, 0, false);
+
+	if (SPI_execute_with_args(query.data, 3, argtypes, values, NULL, true, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not compute the sketches of rollup %d", id);
+	sketches = SPI_tuptable;
+	nsketches = SPI_processed;
+
+	AtEOXact_GUC(false, save_nestlevel);
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+					 "INSERT INTO %s.median_rollup_data (rollup_id, bucket, sketch) "
+					 "VALUES ($1, $2, $3) "
+					 "ON CONFLICT (rollup_id, bucket) DO UPDATE "
+					 "SET sketch = %s.quantile_sketch_combine(median_rollup_data.sketch, excluded.sketch)",
+					 schema, schema);
+	argtypes[2] = BYTEAOID;
+	for (i = 0; i < nsketches; i++)
+	{
+		values[1] = SPI_getbinval(sketches->vals[i], sketches->tupdesc, 1, &isnull);
+		values[2] = SPI_getbinval(sketches->vals[i], sketches->tupdesc, 2, &isnull);
+		if (SPI_execute_with_args(query.data, 3, argtypes, values, NULL, false, 0) != SPI_OK_INSERT)
+			elog(ERROR, "could not store the sketches of rollup %d", id);
+	}
+
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+					 "UPDATE %s.median_rollup_config SET watermark = $2 WHERE id = $1",
+					 schema);
+	argtypes[1] = TIMESTAMPTZOID;
+	values[1] = TimestampTzGetDatum(new_watermark);
+	if (SPI_execute_with_args(query.data, 2, argtypes, values, NULL, false, 0) != SPI_OK_UPDATE)
+		elog(ERROR, "could not update the watermark of rollup %d", id);
+
+	return nsketches;
+}
+
+/*
+ * median_rollup_refresh()
+ *
+ * Rolls up the rows between the watermark and the start of the current
+ * bucket for all configurations and returns the number of buckets written.
+ * The configurations are locked, so that concurrent refreshes wait for each
+ * other instead of rolling up the same rows twice.
+ *
+ * Each configuration is refreshed in a subtransaction of its own. One that
+ * fails, e.g. because its role lost access to the table, is reported as a
+ * warning and rolled back without holding up the others.
+ */
+Datum
+median_rollup_refresh(PG_FUNCTION_ARGS)
+{
+	char	   *schema;
+	StringInfoData query;
+	SPITupleTable *config;
+	uint64		nconfig;
+	uint64		i;
+	volatile int64 nbuckets = 0;
+	MemoryContext old_context = CurrentMemoryContext;
+	ResourceOwner old_owner = CurrentResourceOwner;
+
+	SPI_connect();
+
+	schema = rollup_schema();
+	if (schema == NULL)
+		elog(ERROR, "extension \"median\" is not installed");
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT id, relid::oid, ts_column::text, val_column::text, "
+					 "extract(epoch FROM bucket_width)::float8, "
+					 "coalesce(watermark, '-infinity'), "
+					 "to_timestamp(floor(extract(epoch FROM now()) / extract(epoch FROM bucket_width)) "
+					 "* extract(epoch FROM bucket_width)), "
+					 "owner::oid "
+					 "FROM %s.median_rollup_config ORDER BY id FOR UPDATE", schema);
+	if (SPI_execute(query.data, false, 0) != SPI_OK_SELECT)
+		elog(ERROR, "could not read the rollup configuration");
+	config = SPI_tuptable;
+	nconfig = SPI_processed;
+
+	for (i = 0; i < nconfig; i++)
+	{
+		BeginInternalSubTransaction(NULL);
+		MemoryContextSwitchTo(old_context);
+
+		PG_TRY();
+		{
+			nbuckets += rollup_refresh_one(schema, config->vals[i], config->tupdesc);
+
+			ReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(old_context);
+			CurrentResourceOwner = old_owner;
+		}
+		PG_CATCH();
+		{
+			ErrorData  *edata;
+			bool		isnull;
+			int32		id;
+
+			MemoryContextSwitchTo(old_context);
+			edata = CopyErrorData();
+			FlushErrorState();
+
+			RollbackAndReleaseCurrentSubTransaction();
+			MemoryContextSwitchTo(old_context);
+			CurrentResourceOwner = old_owner;
+
+			id = DatumGetInt32(SPI_getbinval(config->vals[i], config->tupdesc, 1, &isnull));
+			ereport(WARNING,
+					(errcode(edata->sqlerrcode),
+					 errmsg("could not refresh rollup %d", id),
+					 errdetail("%s", edata->message)));
+			FreeErrorData(edata);
+		}
+		PG_END_TRY();
+	}
+
+	SPI_finish();
+
+	PG_RETURN_INT64(nbuckets);
+}
+
+static void
+rollup_sighup(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sighup = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+static void
+rollup_sigterm(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sigterm = true;
+	SetLatch(MyLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Run median_rollup_refresh() in a transaction of its own, if the extension
+ * is installed in the worker's database.
+ */
+static void
+rollup_worker_refresh(void)
+{
+	char	   *schema;
+
+	SetCurrentStatementStartTimestamp();
+	StartTransactionCommand();
+	SPI_connect();
+	PushActiveSnapshot(GetTransactionSnapshot());
+	pgstat_report_activity(STATE_RUNNING, "median rollup refresh");
+
+	schema = rollup_schema();
+	if (schema != NULL)
+	{
+		StringInfoData query;
+
+		initStringInfo(&query);
+		appendStringInfo(&query, "SELECT %s.median_rollup_refresh()", schema);
+		if (SPI_execute(query.data, false, 0) != SPI_OK_SELECT)
+			elog(ERROR, "could not refresh the median rollups");
+	}
+	else
+		elog(DEBUG1, "extension \"median\" is not installed in database \"%s\"",
+			 rollup_database);
+
+	SPI_finish();
+	PopActiveSnapshot();
+	CommitTransactionCommand();
+	pgstat_report_stat(false);
+	pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+void
+median_rollup_worker_main(Datum main_arg)
+{
+	pqsignal(SIGHUP, rollup_sighup);
+	pqsignal(SIGTERM, rollup_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+	BackgroundWorkerInitializeConnection(rollup_database, NULL, 0);
+
+	while (!got_sigterm)
+	{
+		(void) WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+						 rollup_naptime * 1000L, PG_WAIT_EXTENSION);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		if (got_sigterm)
+			break;
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		rollup_worker_refresh();
+	}
+
+	proc_exit(0);
+}
+
+/*
+ * Define the rollup settings and, when loaded through
+ * shared_preload_libraries, register the background worker.
+ */
+void
+median_rollup_init(void)
+{
+	BackgroundWorker worker;
+
+	DefineCustomIntVariable("median.rollup_naptime",
+							"Time between rollup refreshes of the background worker.",
+							NULL,
+							&rollup_naptime,
+							60, 1, INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL, NULL, NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	DefineCustomStringVariable("median.rollup_database",
+							   "Database in which the rollup background worker runs.",
+							   NULL,
+							   &rollup_database,
+							   "postgres",
+							   PGC_POSTMASTER,
+							   0,
+							   NULL, NULL, NULL);
+
+	memset(&worker, 0, sizeof(worker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+	worker.bgw_restart_time = ROLLUP_WORKER_RESTART_SECS;
+	snprintf(worker.bgw_library_name, BGW_MAXLEN, "median");
+	snprintf(worker.bgw_function_name, BGW_MAXLEN, "median_rollup_worker_main");
+	snprintf(worker.bgw_name, BGW_MAXLEN, "median rollup worker");
+	snprintf(worker.bgw_type, BGW_MAXLEN, "median rollup worker");
+	RegisterBackgroundWorker(&worker);
+}
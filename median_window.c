@@ -0,0 +1,153 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <windowapi.h>
+#include <utils/memutils.h>
+
+#include "median.h"
+
+/*
+ * Window functions fast_percent_rank(val) and fast_ntile(val, n).
+ *
+ * fast_percent_rank(val) OVER (PARTITION BY g) gives the same as
+ * percent_rank() OVER (PARTITION BY g ORDER BY val), and fast_ntile(val, n)
+ * the same as ntile(n) OVER (PARTITION BY g ORDER BY val), without the
+ * executor sorting the rows of each partition. Instead, the values of a
+ * partition are buffered in a typed value buffer, which is sorted once on
+ * the first row. Each row then finds the rank of its value by binary search.
+ * NULLs sort last, as they do with ORDER BY val.
+ *
+ * ntile() puts equal values at the boundary of two buckets into either of
+ * them, depending on the sort. fast_ntile() takes them in the order of the
+ * partition.
+ */
+
+PG_FUNCTION_INFO_V1(fast_percent_rank);
+PG_FUNCTION_INFO_V1(fast_ntile);
+
+/* Per-partition data, in the partition-local memory of the window object */
+typedef struct MedianWindowPartition
+{
+	MedianState *values;		/* sorted non-NULL values */
+	int64		num_rows;
+	int64	   *num_seen;		/* rows seen so far per run of equal values */
+	int64		num_nulls_seen;
+	bool		buckets_isnull;
+	int32		buckets;
+} MedianWindowPartition;
+
+static MedianWindowPartition *median_window_partition(FunctionCallInfo fcinfo,
+													  WindowObject winobj);
+
+/*
+ * Return the data of the current partition, buffering and sorting its
+ * values on the first call.
+ */
+static MedianWindowPartition *
+median_window_partition(FunctionCallInfo fcinfo, WindowObject winobj)
+{
+	MedianWindowPartition *partition;
+	int64		i;
+
+	partition = (MedianWindowPartition *)
+		WinGetPartitionLocalMemory(winobj, sizeof(MedianWindowPartition));
+	if (partition->values != NULL)
+		return partition;
+
+	/* Everything lives as long as the partition-local memory */
+	partition->values = median_state_create(GetMemoryChunkContext(partition),
+											get_fn_expr_argtype(fcinfo->flinfo, 0),
+											PG_GET_COLLATION(), false, false);
+	partition->num_rows = WinGetPartitionRowCount(winobj);
+
+	for (i = 0; i < partition->num_rows; i++)
+	{
+		bool		isnull;
+		bool		isout;
+		Datum		value = WinGetFuncArgInPartition(winobj, 0, i, WINDOW_SEEK_HEAD,
+													 false, &isnull, &isout);
+
+		if (!isnull)
+			partition->values->kernel->ingest(partition->values, value);
+	}
+	partition->values->kernel->sort(partition->values);
+
+	return partition;
+}
+
+/*
+ * fast_percent_rank(val): (rank - 1) / (rows - 1), where the rank is one more
+ * than the number of values below val. 0 for a partition of one row.
+ */
+Datum
+fast_percent_rank(PG_FUNCTION_ARGS)
+{
+	WindowObject winobj = PG_WINDOW_OBJECT();
+	MedianWindowPartition *partition = median_window_partition(fcinfo, winobj);
+	MedianState *values = partition->values;
+	bool		isnull;
+	Datum		value;
+	int64		num_below;
+
+	if (partition->num_rows <= 1)
+		PG_RETURN_FLOAT8(0.0);
+
+	value = WinGetFuncArgCurrent(winobj, 0, &isnull);
+	num_below = isnull ? values->num_vals : values->kernel->lower_bound(values, value);
+
+	PG_RETURN_FLOAT8((float8) num_below / (float8) (partition->num_rows - 1));
+}
+
+/*
+ * fast_ntile(val, buckets): the bucket, numbered from 1, of the row in the
+ * sorted partition divided into as equal parts as possible, the first ones
+ * one row larger. The number of buckets is taken from the first row.
+ */
+Datum
+fast_ntile(PG_FUNCTION_ARGS)
+{
+	WindowObject winobj = PG_WINDOW_OBJECT();
+	MedianWindowPartition *partition = median_window_partition(fcinfo, winobj);
+	MedianState *values = partition->values;
+	bool		isnull;
+	Datum		value;
+	int64		position;
+	int64		per_bucket;
+	int64		remainder;
+
+	if (partition->num_seen == NULL)
+	{
+		partition->buckets = DatumGetInt32(WinGetFuncArgCurrent(winobj, 1,
+																&partition->buckets_isnull));
+		if (!partition->buckets_isnull && partition->buckets <= 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_ARGUMENT_FOR_NTILE),
+					 errmsg("argument of fast_ntile must be greater than zero")));
+
+		partition->num_seen = (int64 *)
+			MemoryContextAllocZero(GetMemoryChunkContext(partition),
+								   Max(values->num_vals, 1) * sizeof(int64));
+	}
+	if (partition->buckets_isnull)
+		PG_RETURN_NULL();
+
+	/*
+	 * Equal values take consecutive positions from the first one up, in the
+	 * order their rows come in.
+	 */
+	value = WinGetFuncArgCurrent(winobj, 0, &isnull);
+	if (isnull)
+		position = values->num_vals + partition->num_nulls_seen++;
+	else
+	{
+		int64		num_below = values->kernel->lower_bound(values, value);
+
+		position = num_below + partition->num_seen[num_below]++;
+	}
+
+	/* The first remainder buckets hold one row more */
+	per_bucket = partition->num_rows / partition->buckets;
+	remainder = partition->num_rows % partition->buckets;
+	if (position < remainder * (per_bucket + 1))
+		PG_RETURN_INT32(position / (per_bucket + 1) + 1);
+	PG_RETURN_INT32(remainder + (position - remainder * (per_bucket + 1)) / per_bucket + 1);
+}
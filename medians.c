@@ -0,0 +1,260 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <libpq/pqformat.h>
+#include <utils/array.h>
+#include <utils/arrayaccess.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+
+#include "median.h"
+
+/*
+ * medians(VARIADIC anyarray): the medians of several columns at once.
+ *
+ * SELECT medians(a, b, c) gives the same as ARRAY[median(a), median(b),
+ * median(c)], but with one transition call per row instead of three, and a
+ * single state holding one typed value buffer per column. The final
+ * function then runs the selections of all columns back to back. NULLs are
+ * ignored per column, and a column without values has a NULL median.
+ */
+
+PG_FUNCTION_INFO_V1(medians_transfn);
+PG_FUNCTION_INFO_V1(medians_finalfn);
+PG_FUNCTION_INFO_V1(medians_combinefn);
+PG_FUNCTION_INFO_V1(medians_serialfn);
+PG_FUNCTION_INFO_V1(medians_deserialfn);
+
+typedef struct MediansState
+{
+	int			ncolumns;
+	Oid			typid;
+	Oid			collation;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+	MedianState **columns;		/* one value buffer per column */
+} MediansState;
+
+static MediansState *medians_state_create(MemoryContext agg_context, Oid typid,
+										  Oid collation, int ncolumns, bool hashed);
+
+static MediansState *
+medians_state_create(MemoryContext agg_context, Oid typid, Oid collation,
+					 int ncolumns, bool hashed)
+{
+	MediansState *state;
+	int			i;
+
+	state = (MediansState *) MemoryContextAllocZero(agg_context, sizeof(MediansState));
+	state->ncolumns = ncolumns;
+	state->typid = typid;
+	state->collation = collation;
+	get_typlenbyvalalign(typid, &state->typlen, &state->typbyval, &state->typalign);
+	state->columns = (MedianState **) MemoryContextAlloc(agg_context,
+														 Max(ncolumns, 1) * sizeof(MedianState *));
+	for (i = 0; i < ncolumns; i++)
+		state->columns[i] = median_state_create(agg_context, typid, collation,
+												false, hashed);
+
+	return state;
+}
+
+/*
+ * Transition function of medians(VARIADIC anyarray).
+ *
+ * All rows must have the same number of columns. A NULL array, as from
+ * VARIADIC NULL, is ignored.
+ */
+Datum
+medians_transfn(PG_FUNCTION_ARGS)
+{
+	MediansState *state = NULL;
+	MemoryContext agg_context;
+	AnyArrayType *columns;
+	array_iter	iter;
+	int			ncolumns;
+	int			i;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "medians_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		state = (MediansState *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(state);
+
+	columns = PG_GETARG_ANY_ARRAY_P(1);
+	ncolumns = ArrayGetNItems(AARR_NDIM(columns), AARR_DIMS(columns));
+
+	if (state == NULL)
+		state = medians_state_create(agg_context, AARR_ELEMTYPE(columns),
+									 PG_GET_COLLATION(), ncolumns,
+									 median_agg_hashed(fcinfo));
+	else if (ncolumns != state->ncolumns)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("all rows passed to medians must have the same number of columns")));
+
+	array_iter_setup(&iter, columns);
+	for (i = 0; i < ncolumns; i++)
+	{
+		bool		isnull;
+		Datum		value = array_iter_next(&iter, &isnull, i, state->typlen,
+											state->typbyval, state->typalign);
+
+		if (!isnull)
+			state->columns[i]->kernel->ingest(state->columns[i], value);
+	}
+
+	PG_RETURN_POINTER(state);
+}
+
+/*
+ * Final function of medians: a one-dimensional array of the medians of all
+ * columns.
+ */
+Datum
+medians_finalfn(PG_FUNCTION_ARGS)
+{
+	MediansState *state;
+	Datum	   *values;
+	bool	   *nulls;
+	int			dims[1];
+	int			lbs[1] = {1};
+	int			i;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "medians_finalfn called in non-aggregate context");
+
+	state = PG_ARGISNULL(0) ? NULL : (MediansState *) PG_GETARG_POINTER(0);
+	if (state == NULL)
+		PG_RETURN_NULL();
+	if (state->ncolumns == 0)
+		PG_RETURN_POINTER(construct_empty_array(state->typid));
+
+	values = (Datum *) palloc(state->ncolumns * sizeof(Datum));
+	nulls = (bool *) palloc(state->ncolumns * sizeof(bool));
+	for (i = 0; i < state->ncolumns; i++)
+	{
+		MedianState *column = state->columns[i];
+
+		nulls[i] = column->num_vals == 0;
+		values[i] = nulls[i] ? (Datum) 0 :
+			median_state_select(column, column->num_vals / 2);
+	}
+
+	/* The array gets copies of by-reference values */
+	dims[0] = state->ncolumns;
+	PG_RETURN_POINTER(construct_md_array(values, nulls, 1, dims, lbs, state->typid,
+										 state->typlen, state->typbyval,
+										 state->typalign));
+}
+
+/*
+ * Combine function of medians, appending the values of each column of the
+ * second state to the first one.
+ */
+Datum
+medians_combinefn(PG_FUNCTION_ARGS)
+{
+	MediansState *state1;
+	MediansState *state2;
+	MemoryContext agg_context;
+	int			i;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "medians_combinefn called in non-aggregate context");
+
+	state1 = PG_ARGISNULL(0) ? NULL : (MediansState *) PG_GETARG_POINTER(0);
+	state2 = PG_ARGISNULL(1) ? NULL : (MediansState *) PG_GETARG_POINTER(1);
+
+	if (state2 == NULL)
+	{
+		if (state1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(state1);
+	}
+
+	if (state1 == NULL)
+		state1 = medians_state_create(agg_context, state2->typid,
+									  state2->collation, state2->ncolumns,
+									  median_agg_hashed(fcinfo));
+	else if (state1->ncolumns != state2->ncolumns)
+		ereport(ERROR,
+				(errcode(ERRCODE_ARRAY_SUBSCRIPT_ERROR),
+				 errmsg("all rows passed to medians must have the same number of columns")));
+
+	for (i = 0; i < state1->ncolumns; i++)
+		state1->columns[i]->kernel->merge(state1->columns[i], state2->columns[i]);
+
+	PG_RETURN_POINTER(state1);
+}
+
+/*
+ * Serialization function of medians: the type, collation and number of
+ * columns, then the values of each column as median_serialfn writes them.
+ */
+Datum
+medians_serialfn(PG_FUNCTION_ARGS)
+{
+	MediansState *state;
+	StringInfoData buf;
+	int			i;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "medians_serialfn called in non-aggregate context");
+
+	state = (MediansState *) PG_GETARG_POINTER(0);
+
+	pq_begintypsend(&buf);
+	pq_sendint32(&buf, state->typid);
+	pq_sendint32(&buf, state->collation);
+	pq_sendint32(&buf, state->ncolumns);
+	for (i = 0; i < state->ncolumns; i++)
+	{
+		pq_sendint64(&buf, state->columns[i]->num_vals);
+		state->columns[i]->kernel->serialize(state->columns[i], &buf);
+	}
+
+	PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+Datum
+medians_deserialfn(PG_FUNCTION_ARGS)
+{
+	bytea	   *sstate;
+	MediansState *state;
+	MemoryContext agg_context;
+	StringInfoData buf;
+	Oid			typid;
+	Oid			collation;
+	int			ncolumns;
+	int			i;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "medians_deserialfn called in non-aggregate context");
+
+	sstate = PG_GETARG_BYTEA_PP(0);
+
+	buf.data = VARDATA_ANY(sstate);
+	buf.len = VARSIZE_ANY_EXHDR(sstate);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+
+	typid = pq_getmsgint(&buf, 4);
+	collation = pq_getmsgint(&buf, 4);
+	ncolumns = pq_getmsgint(&buf, 4);
+
+	state = medians_state_create(agg_context, typid, collation, ncolumns,
+								 median_agg_hashed(fcinfo));
+	for (i = 0; i < ncolumns; i++)
+	{
+		int64		num_vals = pq_getmsgint64(&buf);
+
+		state->columns[i]->kernel->deserialize(state->columns[i], &buf, num_vals);
+	}
+	pq_getmsgend(&buf);
+
+	PG_RETURN_POINTER(state);
+}
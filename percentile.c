@@ -0,0 +1,312 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <math.h>
+#include <utils/array.h>
+#include <utils/builtins.h>
+#include <utils/datum.h>
+#include <utils/lsyscache.h>
+#include <utils/timestamp.h>
+#include "catalog/pg_type_d.h"
+
+#include "median.h"
+
+/*
+ * Ordered-set aggregates fast_percentile_disc and fast_percentile_cont.
+ *
+ * These are drop-in replacements for the built-in percentile_disc and
+ * percentile_cont with the same signatures and results. Instead of feeding
+ * the input to a tuplesort, they share the transition function and the
+ * typed value buffer of median() and select the requested ranks in linear
+ * time.
+ */
+
+PG_FUNCTION_INFO_V1(fast_percentile_disc_finalfn);
+PG_FUNCTION_INFO_V1(fast_percentile_disc_multi_finalfn);
+PG_FUNCTION_INFO_V1(fast_percentile_cont_float8_finalfn);
+PG_FUNCTION_INFO_V1(fast_percentile_cont_float8_multi_finalfn);
+PG_FUNCTION_INFO_V1(fast_percentile_cont_interval_finalfn);
+PG_FUNCTION_INFO_V1(fast_percentile_cont_interval_multi_finalfn);
+
+/* Interpolation between two values of the input type */
+typedef Datum (*LerpFunc) (Datum lo, Datum hi, double pct);
+
+static MedianState *percentile_get_state(FunctionCallInfo fcinfo);
+static double percentile_check(double percentile);
+static Datum percentile_cont_final(FunctionCallInfo fcinfo, LerpFunc lerp);
+static Datum percentile_cont_multi_final(FunctionCallInfo fcinfo, LerpFunc lerp);
+static Datum float8_lerp(Datum lo, Datum hi, double pct);
+static Datum interval_lerp(Datum lo, Datum hi, double pct);
+
+/*
+ * Fetch the aggregate state, or NULL if there were no input values.
+ */
+static MedianState *
+percentile_get_state(FunctionCallInfo fcinfo)
+{
+	MedianState *state;
+
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "percentile final function called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		return NULL;
+
+	state = (MedianState *) PG_GETARG_POINTER(0);
+	return state->num_vals > 0 ? state : NULL;
+}
+
+static double
+percentile_check(double percentile)
+{
+	if (percentile < 0 || percentile > 1 || isnan(percentile))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("percentile value %g is not between 0 and 1",
+						percentile)));
+	return percentile;
+}
+
+/* Rank of the first value whose position is at least percentile */
+static inline int64
+percentile_disc_rank(double percentile, int64 num_vals)
+{
+	int64		rownum = (int64) ceil(percentile * num_vals);
+
+	return rownum > 1 ? rownum - 1 : 0;
+}
+
+/*
+ * Final function of fast_percentile_disc(float8 ORDER BY anyelement).
+ */
+Datum
+fast_percentile_disc_finalfn(PG_FUNCTION_ARGS)
+{
+	MedianState *state;
+	double		percentile;
+	Datum		result;
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+	percentile = percentile_check(PG_GETARG_FLOAT8(1));
+
+	if ((state = percentile_get_state(fcinfo)) == NULL)
+		PG_RETURN_NULL();
+
+	result = median_state_select(state, percentile_disc_rank(percentile, state->num_vals));
+
+	if (!state->typbyval)
+		result = datumCopy(result, false, state->typlen);
+	PG_RETURN_DATUM(result);
+}
+
+/*
+ * Final function of fast_percentile_disc(float8[] ORDER BY anyelement).
+ *
+ * The result has the shape of the percentile array; NULL percentiles give
+ * NULL elements.
+ */
+Datum
+fast_percentile_disc_multi_finalfn(PG_FUNCTION_ARGS)
+{
+	MedianState *state;
+	ArrayType  *param;
+	Datum	   *percentiles;
+	bool	   *nulls;
+	int			num_percentiles;
+	int64	   *ranks;
+	Datum	   *values;
+	int			nranks = 0;
+	int			i;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+
+	if ((state = percentile_get_state(fcinfo)) == NULL || PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	param = PG_GETARG_ARRAYTYPE_P(1);
+	deconstruct_array(param, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd',
+					  &percentiles, &nulls, &num_percentiles);
+	if (num_percentiles == 0)
+		PG_RETURN_POINTER(construct_empty_array(state->typid));
+
+	ranks = (int64 *) palloc(num_percentiles * sizeof(int64));
+	values = (Datum *) palloc(num_percentiles * sizeof(Datum));
+	for (i = 0; i < num_percentiles; i++)
+	{
+		if (nulls[i])
+			continue;
+		ranks[nranks++] = percentile_disc_rank(percentile_check(DatumGetFloat8(percentiles[i])),
+											   state->num_vals);
+	}
+	median_state_select_ranks(state, ranks, nranks, values);
+
+	/* Spread the selected values over the non-NULL positions */
+	for (i = num_percentiles - 1; i >= 0; i--)
+	{
+		if (nulls[i])
+			percentiles[i] = (Datum) 0;
+		else
+			percentiles[i] = values[--nranks];
+	}
+
+	get_typlenbyvalalign(state->typid, &typlen, &typbyval, &typalign);
+	PG_RETURN_POINTER(construct_md_array(percentiles, nulls,
+										 ARR_NDIM(param), ARR_DIMS(param),
+										 ARR_LBOUND(param), state->typid,
+										 typlen, typbyval, typalign));
+}
+
+static Datum
+float8_lerp(Datum lo, Datum hi, double pct)
+{
+	double		loval = DatumGetFloat8(lo);
+	double		hival = DatumGetFloat8(hi);
+
+	return Float8GetDatum(loval + (hival - loval) * pct);
+}
+
+static Datum
+interval_lerp(Datum lo, Datum hi, double pct)
+{
+	Datum		diff = DirectFunctionCall2(interval_mi, hi, lo);
+	Datum		mul = DirectFunctionCall2(interval_mul, diff, Float8GetDatum(pct));
+
+	return DirectFunctionCall2(interval_pl, mul, lo);
+}
+
+/*
+ * Interpolate between the values at ranks floor and ceil of
+ * percentile * (n - 1), the same way percentile_cont does.
+ */
+static Datum
+percentile_cont_final(FunctionCallInfo fcinfo, LerpFunc lerp)
+{
+	MedianState *state;
+	double		percentile;
+	double		position;
+	int64		ranks[2];
+	Datum		values[2];
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+	percentile = percentile_check(PG_GETARG_FLOAT8(1));
+
+	if ((state = percentile_get_state(fcinfo)) == NULL)
+		PG_RETURN_NULL();
+
+	position = percentile * (state->num_vals - 1);
+	ranks[0] = (int64) floor(position);
+	ranks[1] = (int64) ceil(position);
+
+	if (ranks[0] == ranks[1])
+	{
+		Datum		result = median_state_select(state, ranks[0]);
+
+		if (!state->typbyval)
+			result = datumCopy(result, false, state->typlen);
+		PG_RETURN_DATUM(result);
+	}
+
+	median_state_select_ranks(state, ranks, 2, values);
+	PG_RETURN_DATUM(lerp(values[0], values[1], position - ranks[0]));
+}
+
+static Datum
+percentile_cont_multi_final(FunctionCallInfo fcinfo, LerpFunc lerp)
+{
+	MedianState *state;
+	ArrayType  *param;
+	Datum	   *percentiles;
+	bool	   *nulls;
+	int			num_percentiles;
+	double	   *positions;
+	int64	   *ranks;
+	Datum	   *values;
+	int			nranks = 0;
+	int			i;
+	int16		typlen;
+	bool		typbyval;
+	char		typalign;
+
+	if ((state = percentile_get_state(fcinfo)) == NULL || PG_ARGISNULL(1))
+		PG_RETURN_NULL();
+
+	param = PG_GETARG_ARRAYTYPE_P(1);
+	deconstruct_array(param, FLOAT8OID, sizeof(float8), FLOAT8PASSBYVAL, 'd',
+					  &percentiles, &nulls, &num_percentiles);
+	if (num_percentiles == 0)
+		PG_RETURN_POINTER(construct_empty_array(state->typid));
+
+	/* Two ranks per percentile, the lower and the upper neighbor */
+	positions = (double *) palloc(num_percentiles * sizeof(double));
+	ranks = (int64 *) palloc(2 * num_percentiles * sizeof(int64));
+	values = (Datum *) palloc(2 * num_percentiles * sizeof(Datum));
+	for (i = 0; i < num_percentiles; i++)
+	{
+		if (nulls[i])
+			continue;
+		positions[i] = percentile_check(DatumGetFloat8(percentiles[i])) * (state->num_vals - 1);
+		ranks[nranks++] = (int64) floor(positions[i]);
+		ranks[nranks++] = (int64) ceil(positions[i]);
+	}
+	median_state_select_ranks(state, ranks, nranks, values);
+
+	for (i = num_percentiles - 1; i >= 0; i--)
+	{
+		Datum		hi;
+		Datum		lo;
+
+		if (nulls[i])
+		{
+			percentiles[i] = (Datum) 0;
+			continue;
+		}
+		hi = values[--nranks];
+		lo = values[--nranks];
+		percentiles[i] = ranks[nranks] == ranks[nranks + 1] ? lo :
+			lerp(lo, hi, positions[i] - ranks[nranks]);
+	}
+
+	get_typlenbyvalalign(state->typid, &typlen, &typbyval, &typalign);
+	PG_RETURN_POINTER(construct_md_array(percentiles, nulls,
+										 ARR_NDIM(param), ARR_DIMS(param),
+										 ARR_LBOUND(param), state->typid,
+										 typlen, typbyval, typalign));
+}
+
+/*
+ * Final function of fast_percentile_cont(float8 ORDER BY float8).
+ */
+Datum
+fast_percentile_cont_float8_finalfn(PG_FUNCTION_ARGS)
+{
+	return percentile_cont_final(fcinfo, float8_lerp);
+}
+
+/*
+ * Final function of fast_percentile_cont(float8[] ORDER BY float8).
+ */
+Datum
+fast_percentile_cont_float8_multi_finalfn(PG_FUNCTION_ARGS)
+{
+	return percentile_cont_multi_final(fcinfo, float8_lerp);
+}
+
+/*
+ * Final function of fast_percentile_cont(float8 ORDER BY interval).
+ */
+Datum
+fast_percentile_cont_interval_finalfn(PG_FUNCTION_ARGS)
+{
+	return percentile_cont_final(fcinfo, interval_lerp);
+}
+
+/*
+ * Final function of fast_percentile_cont(float8[] ORDER BY interval).
+ */
+Datum
+fast_percentile_cont_interval_multi_finalfn(PG_FUNCTION_ARGS)
+{
+	return percentile_cont_multi_final(fcinfo, interval_lerp);
+}
@@ -0,0 +1,576 @@
+#include <postgres.h>
+#include <fmgr.h>
+#include <float.h>
+#include <math.h>
+#include <libpq/pqformat.h>
+#include <utils/builtins.h>
+
+#include "quantile_sketch.h"
+
+/*
+ * Quantile sketches, and their SQL interface: the quantile_sketch aggregate
+ * gives a sketch as bytea, so that it can be stored in a table (such as the
+ * rollups of median_rollup.c), merged with others and queried later.
+ */
+
+#define QUANTILE_SKETCH_INITIAL_BUCKETS	64
+#define QUANTILE_SKETCH_FORMAT_VERSION	1
+
+PG_FUNCTION_INFO_V1(quantile_sketch_transfn);
+PG_FUNCTION_INFO_V1(quantile_sketch_merge_transfn);
+PG_FUNCTION_INFO_V1(quantile_sketch_finalfn);
+PG_FUNCTION_INFO_V1(quantile_sketch_combinefn);
+PG_FUNCTION_INFO_V1(quantile_sketch_serialfn);
+PG_FUNCTION_INFO_V1(quantile_sketch_deserialfn);
+PG_FUNCTION_INFO_V1(quantile_sketch_combine);
+PG_FUNCTION_INFO_V1(quantile_sketch_get_quantile);
+
+static void store_add(QuantileSketch *sketch, QuantileSketchStore *store,
+					  int32 index, double weight);
+static double bucket_value(const QuantileSketch *sketch, int32 index);
+static QuantileSketch *sketch_from_bytea(bytea *data, MemoryContext context);
+static bytea *sketch_to_bytea(const QuantileSketch *sketch);
+
+/*
+ * Initialize an empty sketch with the given relative accuracy. The bucket
+ * limit is scaled so that every accuracy covers the same range of
+ * magnitudes as the default one does with QUANTILE_SKETCH_MAX_BUCKETS.
+ */
+void
+quantile_sketch_init(QuantileSketch *sketch, MemoryContext context,
+					 double relative_accuracy)
+{
+	double		default_log_gamma = log((1 + QUANTILE_SKETCH_RELATIVE_ACCURACY) /
+										(1 - QUANTILE_SKETCH_RELATIVE_ACCURACY));
+
+	Assert(relative_accuracy > 0 && relative_accuracy < 1);
+
+	memset(sketch, 0, sizeof(QuantileSketch));
+	sketch->gamma = (1 + relative_accuracy) / (1 - relative_accuracy);
+	sketch->log_gamma = log(sketch->gamma);
+	sketch->max_buckets = (int32) ceil(QUANTILE_SKETCH_MAX_BUCKETS * default_log_gamma /
+									   sketch->log_gamma);
+	sketch->context = context;
+}
+
+/*
+ * Add weight to a bucket of a store, extending the store's range of buckets
+ * as needed. When the range would exceed the bucket limit of the sketch, the
+ * lowest buckets are merged into the lowest one that remains.
+ */
+static void
+store_add(QuantileSketch *sketch, QuantileSketchStore *store, int32 index,
+		  double weight)
+{
+	int32		low;
+	int32		high;
+	int32		shift;
+
+	if (store->length == 0)
+	{
+		store->offset = index;
+		store->length = 1;
+		if (store->capacity == 0)
+		{
+			store->capacity = QUANTILE_SKETCH_INITIAL_BUCKETS;
+			store->weights = (double *) MemoryContextAlloc(sketch->context,
+														   store->capacity * sizeof(double));
+		}
+		store->weights[0] = weight;
+		return;
+	}
+
+	low = Min(index, store->offset);
+	high = Max(index, store->offset + store->length - 1);
+
+	/* Merge the lowest buckets to stay within the limit */
+	if ((int64) high - low + 1 > sketch->max_buckets)
+	{
+		int32		new_low = high - sketch->max_buckets + 1;
+
+		if (index < new_low)
+			index = new_low;
+		if (store->offset < new_low)
+		{
+			int32		collapsed = new_low - store->offset;
+			double		sum = 0;
+			int32		i;
+
+			for (i = 0; i < collapsed && i < store->length; i++)
+				sum += store->weights[i];
+			if (collapsed < store->length)
+			{
+				memmove(store->weights, store->weights + collapsed,
+						(store->length - collapsed) * sizeof(double));
+				store->length -= collapsed;
+			}
+			else
+			{
+				store->length = 1;
+				store->weights[0] = 0;
+			}
+			store->weights[0] += sum;
+			store->offset = new_low;
+		}
+		low = Min(index, store->offset);
+	}
+
+	if (high - low + 1 > store->capacity)
+	{
+		int32		capacity = store->capacity;
+
+		while (capacity < high - low + 1)
+			capacity *= 2;
+		store->weights = (double *) repalloc(store->weights, capacity * sizeof(double));
+		store->capacity = capacity;
+	}
+
+	/* Extend the range to include index */
+	if (index < store->offset)
+	{
+		shift = store->offset - index;
+		memmove(store->weights + shift, store->weights, store->length * sizeof(double));
+		memset(store->weights, 0, shift * sizeof(double));
+		store->offset = index;
+		store->length += shift;
+	}
+	else if (index >= store->offset + store->length)
+	{
+		shift = index - (store->offset + store->length) + 1;
+		memset(store->weights + store->length, 0, shift * sizeof(double));
+		store->length += shift;
+	}
+
+	store->weights[index - store->offset] += weight;
+}
+
+/*
+ * Add a value with its weight. Zero weights, such as those of decayed values
+ * that underflowed, are left out.
+ */
+void
+quantile_sketch_add(QuantileSketch *sketch, double value, double weight)
+{
+	if (weight == 0)
+		return;
+	if (value == 0)
+		sketch->zero_weight += weight;
+	else
+	{
+		int32		index = (int32) ceil(log(fabs(value)) / sketch->log_gamma);
+
+		store_add(sketch, value > 0 ? &sketch->positive : &sketch->negative,
+				  index, weight);
+	}
+}
+
+/*
+ * Multiply all weights by 2^exponent.
+ */
+void
+quantile_sketch_scale(QuantileSketch *sketch, int exponent)
+{
+	int32		i;
+
+	for (i = 0; i < sketch->positive.length; i++)
+		sketch->positive.weights[i] = ldexp(sketch->positive.weights[i], exponent);
+	for (i = 0; i < sketch->negative.length; i++)
+		sketch->negative.weights[i] = ldexp(sketch->negative.weights[i], exponent);
+	sketch->zero_weight = ldexp(sketch->zero_weight, exponent);
+}
+
+/*
+ * Remove all weights, keeping the bucket arrays for reuse.
+ */
+void
+quantile_sketch_clear(QuantileSketch *sketch)
+{
+	sketch->positive.length = 0;
+	sketch->negative.length = 0;
+	sketch->zero_weight = 0;
+}
+
+/*
+ * Add the weights of src, multiplied by scale, to dst.
+ */
+void
+quantile_sketch_merge(QuantileSketch *dst, const QuantileSketch *src, double scale)
+{
+	int32		i;
+
+	for (i = 0; i < src->negative.length; i++)
+		if (src->negative.weights[i] > 0)
+			store_add(dst, &dst->negative, src->negative.offset + i,
+					  src->negative.weights[i] * scale);
+	for (i = 0; i < src->positive.length; i++)
+		if (src->positive.weights[i] > 0)
+			store_add(dst, &dst->positive, src->positive.offset + i,
+					  src->positive.weights[i] * scale);
+	dst->zero_weight += src->zero_weight * scale;
+}
+
+/* Magnitude of the values in a bucket, within the relative accuracy */
+static double
+bucket_value(const QuantileSketch *sketch, int32 index)
+{
+	return 2 * exp(index * sketch->log_gamma) / (sketch->gamma + 1);
+}
+
+/*
+ * Total weight of the values in the sketch.
+ */
+double
+quantile_sketch_count(const QuantileSketch *sketch)
+{
+	double		total = sketch->zero_weight;
+	int32		i;
+
+	for (i = 0; i < sketch->negative.length; i++)
+		total += sketch->negative.weights[i];
+	for (i = 0; i < sketch->positive.length; i++)
+		total += sketch->positive.weights[i];
+	return total;
+}
+
+/*
+ * Find the quantile: walk the buckets from the most negative to the most
+ * positive value and return the value of the bucket in which the cumulative
+ * weight reaches quantile times the total. Returns false for an empty
+ * sketch.
+ */
+bool
+quantile_sketch_quantile(const QuantileSketch *sketch, double quantile,
+						 double *result)
+{
+	double		total = quantile_sketch_count(sketch);
+	double		cumulative = 0;
+	double		rank;
+	int32		i;
+
+	if (!(total > 0))
+		return false;
+	rank = quantile * total;
+
+	for (i = sketch->negative.length - 1; i >= 0; i--)
+	{
+		cumulative += sketch->negative.weights[i];
+		if (sketch->negative.weights[i] > 0 && cumulative >= rank)
+		{
+			*result = -bucket_value(sketch, sketch->negative.offset + i);
+			return true;
+		}
+	}
+
+	cumulative += sketch->zero_weight;
+	if (sketch->zero_weight > 0 && cumulative >= rank)
+	{
+		*result = 0;
+		return true;
+	}
+
+	for (i = 0; i < sketch->positive.length; i++)
+	{
+		cumulative += sketch->positive.weights[i];
+		if (sketch->positive.weights[i] > 0 && cumulative >= rank)
+		{
+			*result = bucket_value(sketch, sketch->positive.offset + i);
+			return true;
+		}
+	}
+
+	/*
+	 * Rounding in the sums left us just short of the end, so the largest
+	 * value it is.
+	 */
+	if (sketch->positive.length > 0)
+		*result = bucket_value(sketch, sketch->positive.offset + sketch->positive.length - 1);
+	else if (sketch->zero_weight > 0)
+		*result = 0;
+	else
+	{
+		for (i = 0; sketch->negative.weights[i] == 0; i++)
+			;
+		*result = -bucket_value(sketch, sketch->negative.offset + i);
+	}
+	return true;
+}
+
+static void
+store_send(StringInfo buf, const QuantileSketchStore *store)
+{
+	int32		i;
+
+	pq_sendint32(buf, store->offset);
+	pq_sendint32(buf, store->length);
+	for (i = 0; i < store->length; i++)
+		pq_sendfloat8(buf, store->weights[i]);
+}
+
+/*
+ * Read a store written by store_send. The data may come from anywhere, so
+ * the bucket range must fit in the message and lie within the indexes of
+ * finite values, and the weights must be finite and non-negative.
+ */
+static void
+store_receive(QuantileSketch *sketch, StringInfo buf, QuantileSketchStore *store)
+{
+	int32		offset = pq_getmsgint(buf, 4);
+	int32		length = pq_getmsgint(buf, 4);
+	int32		min_index = (int32) floor(log(DBL_MIN * DBL_EPSILON) / sketch->log_gamma);
+	int32		max_index = (int32) ceil(log(DBL_MAX) / sketch->log_gamma);
+	int32		i;
+
+	if (length < 0 || length > (buf->len - buf->cursor) / (int) sizeof(float8) ||
+		offset < min_index || (int64) offset + length - 1 > max_index)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid quantile sketch")));
+
+	for (i = 0; i < length; i++)
+	{
+		double		weight = pq_getmsgfloat8(buf);
+
+		if (!isfinite(weight) || weight < 0)
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+					 errmsg("invalid quantile sketch")));
+		if (weight > 0)
+			store_add(sketch, store, offset + i, weight);
+	}
+}
+
+void
+quantile_sketch_send(StringInfo buf, const QuantileSketch *sketch)
+{
+	pq_sendbyte(buf, QUANTILE_SKETCH_FORMAT_VERSION);
+	pq_sendfloat8(buf, sketch->zero_weight);
+	store_send(buf, &sketch->negative);
+	store_send(buf, &sketch->positive);
+}
+
+/*
+ * Add the weights of a sketch written by quantile_sketch_send to sketch.
+ */
+void
+quantile_sketch_receive(QuantileSketch *sketch, StringInfo buf)
+{
+	double		zero_weight;
+
+	if (pq_getmsgbyte(buf) != QUANTILE_SKETCH_FORMAT_VERSION)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid quantile sketch")));
+
+	zero_weight = pq_getmsgfloat8(buf);
+	if (!isfinite(zero_weight) || zero_weight < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+				 errmsg("invalid quantile sketch")));
+	sketch->zero_weight += zero_weight;
+
+	store_receive(sketch, buf, &sketch->negative);
+	store_receive(sketch, buf, &sketch->positive);
+}
+
+static QuantileSketch *
+sketch_from_bytea(bytea *data, MemoryContext context)
+{
+	QuantileSketch *sketch;
+	StringInfoData buf;
+
+	sketch = (QuantileSketch *) MemoryContextAlloc(context, sizeof(QuantileSketch));
+	quantile_sketch_init(sketch, context, QUANTILE_SKETCH_RELATIVE_ACCURACY);
+
+	buf.data = VARDATA_ANY(data);
+	buf.len = VARSIZE_ANY_EXHDR(data);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+
+	quantile_sketch_receive(sketch, &buf);
+	pq_getmsgend(&buf);
+
+	return sketch;
+}
+
+static bytea *
+sketch_to_bytea(const QuantileSketch *sketch)
+{
+	StringInfoData buf;
+
+	pq_begintypsend(&buf);
+	quantile_sketch_send(&buf, sketch);
+	return pq_endtypsend(&buf);
+}
+
+/*
+ * Transition function of quantile_sketch(float8). NULLs are ignored.
+ */
+Datum
+quantile_sketch_transfn(PG_FUNCTION_ARGS)
+{
+	QuantileSketch *sketch = NULL;
+	MemoryContext agg_context;
+	double		value;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "quantile_sketch_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		sketch = (QuantileSketch *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(sketch);
+
+	value = PG_GETARG_FLOAT8(1);
+	if (isnan(value) || isinf(value))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("quantile_sketch input values must be finite")));
+
+	if (sketch == NULL)
+	{
+		sketch = (QuantileSketch *) MemoryContextAlloc(agg_context, sizeof(QuantileSketch));
+		quantile_sketch_init(sketch, agg_context, QUANTILE_SKETCH_RELATIVE_ACCURACY);
+	}
+	quantile_sketch_add(sketch, value, 1);
+
+	PG_RETURN_POINTER(sketch);
+}
+
+/*
+ * Transition function of quantile_sketch_merge(bytea), which merges stored
+ * sketches.
+ */
+Datum
+quantile_sketch_merge_transfn(PG_FUNCTION_ARGS)
+{
+	QuantileSketch *sketch = NULL;
+	MemoryContext agg_context;
+	bytea	   *data;
+	StringInfoData buf;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "quantile_sketch_merge_transfn called in non-aggregate context");
+
+	if (!PG_ARGISNULL(0))
+		sketch = (QuantileSketch *) PG_GETARG_POINTER(0);
+
+	if (PG_ARGISNULL(1))
+		PG_RETURN_POINTER(sketch);
+
+	if (sketch == NULL)
+	{
+		sketch = (QuantileSketch *) MemoryContextAlloc(agg_context, sizeof(QuantileSketch));
+		quantile_sketch_init(sketch, agg_context, QUANTILE_SKETCH_RELATIVE_ACCURACY);
+	}
+
+	data = PG_GETARG_BYTEA_PP(1);
+	buf.data = VARDATA_ANY(data);
+	buf.len = VARSIZE_ANY_EXHDR(data);
+	buf.maxlen = 0;
+	buf.cursor = 0;
+	quantile_sketch_receive(sketch, &buf);
+	pq_getmsgend(&buf);
+
+	PG_RETURN_POINTER(sketch);
+}
+
+/*
+ * Final function of quantile_sketch and quantile_sketch_merge, giving the
+ * stored form of the sketch.
+ */
+Datum
+quantile_sketch_finalfn(PG_FUNCTION_ARGS)
+{
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "quantile_sketch_finalfn called in non-aggregate context");
+
+	if (PG_ARGISNULL(0))
+		PG_RETURN_NULL();
+
+	PG_RETURN_BYTEA_P(sketch_to_bytea((QuantileSketch *) PG_GETARG_POINTER(0)));
+}
+
+Datum
+quantile_sketch_combinefn(PG_FUNCTION_ARGS)
+{
+	QuantileSketch *sketch1;
+	QuantileSketch *sketch2;
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "quantile_sketch_combinefn called in non-aggregate context");
+
+	sketch1 = PG_ARGISNULL(0) ? NULL : (QuantileSketch *) PG_GETARG_POINTER(0);
+	sketch2 = PG_ARGISNULL(1) ? NULL : (QuantileSketch *) PG_GETARG_POINTER(1);
+
+	if (sketch2 == NULL)
+	{
+		if (sketch1 == NULL)
+			PG_RETURN_NULL();
+		PG_RETURN_POINTER(sketch1);
+	}
+
+	if (sketch1 == NULL)
+	{
+		sketch1 = (QuantileSketch *) MemoryContextAlloc(agg_context, sizeof(QuantileSketch));
+		quantile_sketch_init(sketch1, agg_context, QUANTILE_SKETCH_RELATIVE_ACCURACY);
+	}
+	quantile_sketch_merge(sketch1, sketch2, 1);
+
+	PG_RETURN_POINTER(sketch1);
+}
+
+Datum
+quantile_sketch_serialfn(PG_FUNCTION_ARGS)
+{
+	if (!AggCheckCallContext(fcinfo, NULL))
+		elog(ERROR, "quantile_sketch_serialfn called in non-aggregate context");
+
+	PG_RETURN_BYTEA_P(sketch_to_bytea((QuantileSketch *) PG_GETARG_POINTER(0)));
+}
+
+Datum
+quantile_sketch_deserialfn(PG_FUNCTION_ARGS)
+{
+	MemoryContext agg_context;
+
+	if (!AggCheckCallContext(fcinfo, &agg_context))
+		elog(ERROR, "quantile_sketch_deserialfn called in non-aggregate context");
+
+	PG_RETURN_POINTER(sketch_from_bytea(PG_GETARG_BYTEA_PP(0), agg_context));
+}
+
+/*
+ * quantile_sketch_combine(bytea, bytea) merges two stored sketches.
+ */
+Datum
+quantile_sketch_combine(PG_FUNCTION_ARGS)
+{
+	QuantileSketch *sketch = sketch_from_bytea(PG_GETARG_BYTEA_PP(0), CurrentMemoryContext);
+	QuantileSketch *other = sketch_from_bytea(PG_GETARG_BYTEA_PP(1), CurrentMemoryContext);
+
+	quantile_sketch_merge(sketch, other, 1);
+
+	PG_RETURN_BYTEA_P(sketch_to_bytea(sketch));
+}
+
+/*
+ * quantile_sketch_quantile(bytea, float8) gives a quantile of a stored sketch.
+ */
+Datum
+quantile_sketch_get_quantile(PG_FUNCTION_ARGS)
+{
+	QuantileSketch *sketch = sketch_from_bytea(PG_GETARG_BYTEA_PP(0), CurrentMemoryContext);
+	double		quantile = PG_GETARG_FLOAT8(1);
+	double		result;
+
+	if (quantile < 0 || quantile > 1 || isnan(quantile))
+		ereport(ERROR,
+				(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+				 errmsg("quantile value %g is not between 0 and 1", quantile)));
+
+	if (!quantile_sketch_quantile(sketch, quantile, &result))
+		PG_RETURN_NULL();
+	PG_RETURN_FLOAT8(result);
+}
@@ -0,0 +1,60 @@
+/*
+ * Mergeable quantile sketch with relative accuracy guarantees.
+ *
+ * A DDSketch-style sketch: bucket i holds the weight of the values v with
+ * gamma^(i - 1) < |v| <= gamma^i, gamma = (1 + a) / (1 - a), and reports
+ * them as 2 gamma^i / (gamma + 1), which is within relative error a of all
+ * of them. Quantiles are thus within a of the exact ones, a = 1% unless the
+ * sketch is initialized otherwise. Positive and negative values have a store
+ * of buckets each, limited to QUANTILE_SKETCH_MAX_BUCKETS buckets at the
+ * default accuracy (and proportionally more or fewer at others). Beyond that
+ * (a range of about 10^17 between the smallest and largest magnitude) the
+ * buckets of the smallest magnitudes are merged, which only affects the
+ * accuracy for those.
+ *
+ * Weights are doubles, so the same sketch serves plain counts as well as
+ * decayed weights. Two sketches merge by adding up their buckets.
+ */
+#ifndef QUANTILE_SKETCH_H
+#define QUANTILE_SKETCH_H
+
+#include <postgres.h>
+#include <lib/stringinfo.h>
+
+#define QUANTILE_SKETCH_RELATIVE_ACCURACY	0.01
+#define QUANTILE_SKETCH_MAX_BUCKETS			2048
+
+/* Weights of a contiguous range of bucket indexes */
+typedef struct QuantileSketchStore
+{
+	int32		offset;			/* bucket index of weights[0] */
+	int32		length;			/* number of buckets in use */
+	int32		capacity;
+	double	   *weights;
+} QuantileSketchStore;
+
+typedef struct QuantileSketch
+{
+	double		gamma;
+	double		log_gamma;
+	int32		max_buckets;	/* per store */
+	double		zero_weight;
+	QuantileSketchStore positive;
+	QuantileSketchStore negative;	/* indexed by the magnitude of the values */
+	MemoryContext context;		/* holds the bucket arrays */
+} QuantileSketch;
+
+extern void quantile_sketch_init(QuantileSketch *sketch, MemoryContext context,
+								 double relative_accuracy);
+extern void quantile_sketch_add(QuantileSketch *sketch, double value, double weight);
+extern void quantile_sketch_scale(QuantileSketch *sketch, int exponent);
+extern void quantile_sketch_clear(QuantileSketch *sketch);
+extern void quantile_sketch_merge(QuantileSketch *dst, const QuantileSketch *src,
+								  double scale);
+extern double quantile_sketch_count(const QuantileSketch *sketch);
+extern bool quantile_sketch_quantile(const QuantileSketch *sketch, double quantile,
+									 double *result);
+extern void quantile_sketch_send(StringInfo buf, const QuantileSketch *sketch);
+extern void quantile_sketch_receive(QuantileSketch *sketch, StringInfo buf);
+
+#endif							/* QUANTILE_SKETCH_H */
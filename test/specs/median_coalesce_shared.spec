@@ -0,0 +1,76 @@
+# Sharing of median_coalesced() between sessions, with the library preloaded
+# by test/isolation.conf.
+#
+# The filter calls coalesce_counted(), which waits while s0 locks
+# coalesce_gate and counts the rows it is evaluated on in a sequence. s1
+# computes the median and waits for the lock with its request registered.
+# s2 then makes the same request, and the count tells whether s2 took the
+# result of s1 or scanned the table itself.
+
+setup
+{
+	CREATE TABLE coalesce_shared (val int);
+	INSERT INTO coalesce_shared SELECT i FROM generate_series(1, 10) AS i;
+	CREATE TABLE coalesce_gate ();
+	CREATE SEQUENCE coalesce_rows;
+	CREATE FUNCTION coalesce_counted() RETURNS boolean STABLE LANGUAGE plpgsql AS $$
+	BEGIN
+		PERFORM FROM coalesce_gate;
+		PERFORM nextval('coalesce_rows');
+		RETURN true;
+	END
+	$$;
+
+	CREATE TABLE coalesce_tenants (tenant text, val int);
+	INSERT INTO coalesce_tenants VALUES ('a', 1), ('a', 2), ('a', 3), ('b', 10), ('b', 20), ('b', 30);
+	ALTER TABLE coalesce_tenants ENABLE ROW LEVEL SECURITY;
+	CREATE POLICY coalesce_tenant ON coalesce_tenants USING (tenant = current_setting('app.tenant'));
+	CREATE ROLE regress_coalesce_tenant;
+	GRANT SELECT ON coalesce_tenants, coalesce_gate TO regress_coalesce_tenant;
+	GRANT USAGE ON SEQUENCE coalesce_rows TO regress_coalesce_tenant;
+
+	DO $$ BEGIN PERFORM pg_stat_force_next_flush(); END $$;
+}
+
+teardown
+{
+	DROP TABLE coalesce_shared, coalesce_gate, coalesce_tenants;
+	DROP FUNCTION coalesce_counted();
+	DROP SEQUENCE coalesce_rows;
+	DROP ROLE regress_coalesce_tenant;
+}
+
+session s0
+step s0_lock	{ BEGIN; LOCK TABLE coalesce_gate IN ACCESS EXCLUSIVE MODE; }
+step s0_commit	{ COMMIT; }
+
+session s1
+step s1_median	{ SELECT median_coalesced('coalesce_shared', 'val', 'coalesce_counted()'); }
+
+session s2
+setup			{ SET deadlock_timeout = '10min'; }
+step s2_impatient	{ SET deadlock_timeout = '10ms'; }
+step s2_median	{ SELECT median_coalesced('coalesce_shared', 'val', 'coalesce_counted()'); }
+step s2_rows	{ SELECT last_value AS rows_scanned FROM coalesce_rows; }
+
+# Two sessions of the same role for different tenants
+session s3
+setup			{ SET app.tenant = 'a'; SET ROLE regress_coalesce_tenant; }
+step s3_median	{ SELECT median_coalesced('coalesce_tenants', 'val', 'coalesce_counted()'); }
+teardown		{ RESET ROLE; }
+
+session s4
+setup			{ SET deadlock_timeout = '10min'; SET app.tenant = 'b'; SET ROLE regress_coalesce_tenant; }
+step s4_median	{ SELECT median_coalesced('coalesce_tenants', 'val', 'coalesce_counted()'); }
+teardown		{ RESET ROLE; }
+
+# s2 follows s1 and takes its result, so the table is scanned once
+permutation s0_lock s1_median s2_median(s1_median) s0_commit s2_rows
+
+# s1 waits for a lock longer than s2's deadlock_timeout, so s2 stops
+# following and scans the table itself, after waiting for the lock too
+permutation s2_impatient s0_lock s1_median s2_median(s1_median) s0_commit s2_rows
+
+# Row-level security can make the rows depend on anything, here a setting,
+# so each tenant computes its own median
+permutation s0_lock s3_median s4_median(s3_median) s0_commit
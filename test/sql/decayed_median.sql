@@ -0,0 +1,53 @@
+-- Values drift upwards over time
+CREATE TABLE samples AS
+SELECT timestamptz '2024-01-01 00:00+00' + i * interval '1 minute' AS ts,
+       (i * 7919 % 1000 + i / 2)::float8 AS val
+FROM generate_series(1, 2000) AS i;
+
+-- Exact weighted median, with weights halving every half-life into the past
+CREATE FUNCTION exact_decayed_median(half_life interval) RETURNS float8 AS $$
+  SELECT min(val)
+  FROM (SELECT val, sum(weight) OVER (ORDER BY val ROWS UNBOUNDED PRECEDING) AS cumulative,
+               sum(weight) OVER () AS total
+        FROM (SELECT val, 2 ^ (extract(epoch FROM ts - max(ts) OVER ()) /
+                               extract(epoch FROM half_life)) AS weight
+              FROM samples) AS w) AS c
+  WHERE cumulative >= total / 2;
+$$ LANGUAGE sql;
+
+-- Within 1% of the exact result, and above the plain median
+SELECT half_life,
+       abs(decayed_median(ts, val, half_life) - exact_decayed_median(half_life)) <=
+         0.01 * exact_decayed_median(half_life) AS accurate,
+       decayed_median(ts, val, half_life) > median(val) AS recent
+FROM samples, (VALUES (interval '1 hour'), ('6 hours'), ('1 day')) AS h(half_life)
+GROUP BY half_life ORDER BY half_life;
+
+-- Weights are relative, so shifting all timestamps does not matter
+SELECT decayed_median(ts, val, '1 hour') = decayed_median(ts + interval '100 years', val, '1 hour') AS shifted
+FROM samples;
+
+-- Parallel aggregation
+CREATE TABLE exact AS SELECT exact_decayed_median('1 hour') AS exact;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+SELECT abs(decayed - exact) <= 0.01 * exact AS accurate
+FROM (SELECT decayed_median(ts, val, '1 hour') AS decayed FROM samples) AS d,
+     exact;
+
+RESET ALL;
+
+-- Far apart timestamps: the newer value outweighs everything before
+SELECT abs(decayed_median(ts, val, '1 millisecond') - 500) <= 5 AS accurate
+FROM (VALUES (timestamptz '2024-01-01 00:00+00', 1::float8), ('2024-01-01 00:00+00', 2),
+             ('2024-01-31 00:00+00', 500)) AS t(ts, val);
+
+-- NULLs are ignored, no values give NULL
+SELECT decayed_median(ts, val, '1 hour') FROM (VALUES (NULL::timestamptz, 1::float8), (now(), NULL)) AS t(ts, val);
+
+-- Invalid arguments
+SELECT decayed_median(ts, val, '-1 hour') FROM samples;
+SELECT decayed_median(now(), 'NaN', '1 hour');
@@ -0,0 +1,44 @@
+CREATE TABLE pointvals(p point);
+
+-- Test empty table
+SELECT geometric_median(p) FROM pointvals;
+
+-- Symmetric set whose center is one of the points, with NULLs
+INSERT INTO pointvals VALUES
+       ('(0,0)'),
+       ('(2,0)'),
+       ('(0,2)'),
+       ('(2,2)'),
+       ('(1,1)'),
+       (NULL);
+
+SELECT geometric_median(p) FROM pointvals;
+
+-- Collinear points: the geometric median is the one-dimensional median
+SELECT geometric_median(p) <-> point '(1,0)' < 1e-6 AS close
+FROM (VALUES (point '(0,0)'), ('(1,0)'), ('(10,0)')) AS t(p);
+
+-- A single far outlier barely moves the geometric median
+SELECT geometric_median(p, 1e-12) <-> point '(1,1)' < 0.5 AS close
+FROM (SELECT p FROM pointvals UNION ALL SELECT point '(1000,1000)') AS t(p);
+
+-- Invalid tolerance
+SELECT geometric_median(p, 0) FROM pointvals;
+
+-- Coordinates as float8 arrays
+CREATE TABLE arrayvals(v float8[]);
+
+INSERT INTO arrayvals VALUES
+       ('{1,1,1}'),
+       ('{0,1,1}'),
+       ('{2,1,1}'),
+       ('{1,0,1}'),
+       ('{1,2,1}'),
+       ('{1,1,0}'),
+       ('{1,1,2}'),
+       (NULL);
+
+SELECT geometric_median(v) FROM arrayvals;
+
+-- Arrays of different lengths
+SELECT geometric_median(v) FROM (VALUES ('{1,2}'::float8[]), ('{1,2,3}')) AS t(v);
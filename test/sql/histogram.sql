@@ -0,0 +1,31 @@
+-- Counts per bucket
+SELECT histogram_quantile('{1, 2, 4, 8}', '{10, 20, 30, 40}', 0.5) AS median,
+       histogram_quantile('{1, 2, 4, 8}', '{10, 20, 30, 40}', 0.05) AS first_bucket,
+       histogram_quantile('{-1, 2, 4, 8}', '{10, 20, 30, 40}', 0.05) AS negative_bound;
+
+-- Cumulative counts with a +Infinity bucket, as exported by Prometheus
+SELECT histogram_quantile('{0.1, 0.5, 1, Infinity}', '{10, 30, 60, 100}', 0.5, true) AS median,
+       histogram_quantile('{0.1, 0.5, 1, Infinity}', '{10, 30, 60, 100}', 0.95, true) AS p95;
+
+-- Empty histogram
+SELECT histogram_quantile('{1, 2}', '{0, 0}', 0.5);
+
+-- Summing histograms across rows
+CREATE TABLE histograms (bounds float8[], counts int8[], cumulative int8[]);
+INSERT INTO histograms VALUES
+  ('{1, 2, 4, 8}', '{1, 2, 3, 4}', '{1, 3, 6, 10}'),
+  ('{1, 2, 4, 8}', '{5, 5, 5, 5}', '{5, 10, 15, 20}'),
+  (NULL, NULL, NULL),
+  ('{1, 2, 4, 8}', '{4, 3, 2, 1}', '{4, 7, 9, 10}');
+SELECT histogram_quantile_agg(bounds, counts, 0.5) AS counts,
+       histogram_quantile_agg(bounds, cumulative, 0.5, true) AS cumulative
+FROM histograms;
+
+-- Invalid histograms
+SELECT histogram_quantile('{1, 2, 4}', '{1, 2}', 0.5);
+SELECT histogram_quantile('{1, 4, 2}', '{1, 2, 3}', 0.5);
+SELECT histogram_quantile('{1, 2, 4}', '{1, 3, 2}', 0.5, true);
+SELECT histogram_quantile('{1, 2, 4}', '{1, 2, 3}', 1.5);
+SELECT histogram_quantile('{1, 2, 4}', '{9223372036854775807, 9223372036854775807, 2}', 0.5);
+SELECT histogram_quantile_agg(bounds, counts, 0.5)
+FROM (VALUES ('{1, 2}'::float8[], '{1, 1}'::int8[]), ('{1, 3}', '{1, 1}')) AS t(bounds, counts);
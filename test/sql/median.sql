@@ -49,3 +49,74 @@ SELECT TIMESTAMP 'epoch' + (i * INTERVAL '1 second')
 FROM generate_series(0, 100000) as T(i);
 
 SELECT median(val) FROM timestampvals;
+
+-- All values NULL
+SELECT median(val) FROM intvals WHERE val IS NULL;
+
+-- Other native types
+SELECT median(val::int2) AS int2, median(val::int8) AS int8,
+       median(val::float4) AS float4, median(val::float8) AS float8
+FROM intvals;
+
+-- NaN sorts above all other values
+SELECT median(val) FROM (VALUES ('NaN'::float8), ('1'), ('NaN'), ('-Infinity'), ('NaN')) AS t(val);
+
+-- Numeric and date values
+SELECT median(val::numeric) AS numeric, median(DATE '2020-01-01' + val) AS date
+FROM intvals;
+
+-- Many groups
+SELECT i % 3 AS g, median(i) FROM generate_series(1, 1000) AS t(i) GROUP BY 1 ORDER BY 1;
+
+-- Moving window frames
+SELECT x, median(x) OVER (ORDER BY x ROWS BETWEEN 1 PRECEDING AND 1 FOLLOWING)
+FROM generate_series(1, 5) AS t(x);
+
+SELECT val, median(val) OVER (ORDER BY val ROWS BETWEEN 1 PRECEDING AND 1 FOLLOWING)
+FROM textvals;
+
+-- Parallel aggregation
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+SELECT median(val) FROM timestampvals;
+SELECT median(val) FROM textvals;
+
+RESET ALL;
+
+-- Sorted input
+SELECT median(x ORDER BY x) AS asc_even, median(x ORDER BY x DESC) AS desc_even
+FROM generate_series(1, 10) AS t(x);
+SELECT median(x ORDER BY x) AS asc_odd, median(x ORDER BY x DESC) AS desc_odd
+FROM generate_series(1, 11) AS t(x);
+SELECT median(val ORDER BY val DESC) FROM textvals;
+SELECT median(val ORDER BY val) FROM timestampvals;
+
+-- Inputs that defeat median-of-three pivots
+SELECT pattern, median(x) = (array_agg(x ORDER BY x))[count(*) / 2 + 1] AS correct
+FROM (SELECT 'organ pipe' AS pattern, CASE WHEN i <= 50000 THEN i ELSE 100001 - i END AS x
+      FROM generate_series(1, 100000) AS i
+      UNION ALL
+      SELECT 'musser', CASE WHEN i <= 50000 AND i % 2 = 1 THEN i
+                            WHEN i <= 50000 THEN 50000 + i - 1
+                            ELSE 2 * (i - 50000) END
+      FROM generate_series(1, 100000) AS i
+      UNION ALL
+      SELECT 'sawtooth', i % 100 FROM generate_series(1, 100001) AS i
+      UNION ALL
+      SELECT 'few distinct', i % 3 FROM generate_series(1, 100000) AS i) AS t
+GROUP BY pattern ORDER BY pattern;
+
+-- Sorted aggregation hands the value buffer from group to group
+SET enable_hashagg = off;
+SELECT g, median(x) AS int, median(x::text) AS text
+FROM generate_series(1, 4) AS g, generate_series(1, (5 - g) * 1000, g) AS x
+GROUP BY g ORDER BY g;
+RESET enable_hashagg;
+
+-- Values stored out of line and compressed are detoasted before buffering
+CREATE TABLE toasted (v text) WITH (toast_tuple_target = 128);
+INSERT INTO toasted SELECT repeat(chr(65 + i), 100000) || i FROM generate_series(0, 4) AS i;
+SELECT left(median(v), 3) AS prefix, length(median(v)) FROM toasted;
@@ -0,0 +1,66 @@
+CREATE TABLE approx_values AS
+SELECT i, i % 3 AS grp, (i * 7919 % 100000)::int8 AS ival,
+       ((i * 7919 % 100000) / 10.0)::float8 AS fval
+FROM generate_series(1, 100000) AS i;
+
+-- Exact by default
+SELECT median(ival) FROM approx_values;
+SHOW median.mode;
+
+-- Within 1% of the exact medians (50000, 5000 and 5000)
+SET median.mode = approximate;
+
+SELECT median(ival) AS int8, median(ival::int4) AS int4, median((ival / 10)::int2) AS int2
+FROM approx_values;
+
+SELECT abs(median(fval) - 5000) <= 50 AS float8_within,
+       abs(median(fval::float4) - 5000) <= 50 AS float4_within
+FROM approx_values;
+
+SELECT grp, median(ival) FROM approx_values GROUP BY grp ORDER BY grp;
+
+SET median.approximate_accuracy = 0.001;
+SELECT median(ival) FROM approx_values;
+RESET median.approximate_accuracy;
+
+-- Ordered input, percentiles, window frames and other types stay exact
+SELECT median(ival ORDER BY ival) AS ordered,
+       fast_percentile_disc(0.5) WITHIN GROUP (ORDER BY ival) AS percentile,
+       median(ival::numeric) AS numeric
+FROM approx_values;
+
+SELECT DISTINCT median(ival) OVER () FROM approx_values;
+
+-- Infinities and NaNs sort around the sketched values
+SELECT s, median(x)
+FROM (VALUES (1, 1::float8), (1, 'Infinity'), (1, 'NaN'), (1, '-Infinity'), (1, 'Infinity'),
+             (2, 'NaN'), (2, 'NaN'), (2, 1),
+             (3, '-Infinity'), (3, '-Infinity'), (3, 3)) AS t(s, x)
+GROUP BY s ORDER BY s;
+
+-- NULLs are ignored, no values give NULL
+SELECT median(ival) FROM approx_values WHERE i < 0;
+SELECT median(x) FROM (VALUES (NULL::float8)) AS t(x);
+
+-- Auto switches to a sketch above the threshold only
+SET median.mode = auto;
+SET median.approximate_threshold = 1000;
+
+SELECT median(ival) FILTER (WHERE i <= 1000) AS exact,
+       median(ival) FILTER (WHERE i <= 1001) AS approximate
+FROM approx_values;
+
+-- Parallel aggregation merges the sketches of the workers
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+SELECT median(ival) FROM approx_values;
+
+SET median.mode = approximate;
+SELECT median(ival) FROM approx_values;
+
+RESET ALL;
+
+SET median.mode = fast;
@@ -0,0 +1,32 @@
+CREATE TABLE civals AS
+SELECT i, (i * 7919 % 1000)::float8 AS val
+FROM generate_series(1, 1000) AS i;
+
+-- Small examples; too few values for the bounds give NULL bounds
+SELECT median_ci(x, 0.95) FROM generate_series(1, 10) AS t(x);
+SELECT median_ci(x, 0.95) FROM generate_series(1, 5) AS t(x);
+
+-- Wider intervals for higher confidence, around the same median as median()
+SELECT confidence, (ci).*, (ci).median = m AS same_median
+FROM (SELECT confidence, median_ci(val, confidence) AS ci, median(val) AS m
+      FROM civals, (VALUES (0.5), (0.9), (0.99)) AS c(confidence)
+      GROUP BY confidence) AS s
+ORDER BY confidence;
+
+-- NULLs are ignored, no values give NULL
+SELECT median_ci(val, 0.95) FROM (VALUES (NULL::float8)) AS t(val);
+
+-- Parallel aggregation
+CREATE TABLE ci_serial AS SELECT median_ci(val, 0.9) AS ci FROM civals;
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+SELECT median_ci(val, 0.9) = (SELECT ci FROM ci_serial) AS same FROM civals;
+
+RESET ALL;
+
+-- Invalid confidence levels
+SELECT median_ci(val, 1) FROM civals;
+SELECT median_ci(val, NULL) FROM civals;
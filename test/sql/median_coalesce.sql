@@ -0,0 +1,33 @@
+CREATE TABLE coalesce_values AS
+SELECT i, i * 7919 % 1000 AS val, i % 2 AS grp
+FROM generate_series(1, 1001) AS i;
+
+-- Without median in shared_preload_libraries, the median is computed directly
+SELECT median_coalesced('coalesce_values', 'val') AS coalesced,
+       (SELECT median(val) FROM coalesce_values) AS median;
+
+SELECT median_coalesced('coalesce_values', 'val', 'i <= 100') AS coalesced,
+       (SELECT median(val) FROM coalesce_values WHERE i <= 100) AS median;
+
+-- No rows or NULL arguments give NULL
+SELECT median_coalesced('coalesce_values', 'val', 'i < 0') IS NULL AS no_rows,
+       median_coalesced(NULL, 'val') IS NULL AS no_relation,
+       median_coalesced('coalesce_values', NULL) IS NULL AS no_column;
+
+-- Identifiers are quoted
+CREATE TABLE "Coalesce Values" AS SELECT i AS "Val" FROM generate_series(1, 9) AS i;
+SELECT median_coalesced('"Coalesce Values"', 'Val');
+
+-- Changes of the current transaction are seen
+BEGIN;
+INSERT INTO "Coalesce Values" SELECT 100 FROM generate_series(1, 10);
+SELECT median_coalesced('"Coalesce Values"', 'Val');
+ROLLBACK;
+
+-- Unknown columns
+SELECT median_coalesced('coalesce_values', 'missing');
+
+-- The filter can only be a condition on the rows
+SELECT median_coalesced('coalesce_values', 'val', 'true) UNION ALL (SELECT 1');
+SELECT median_coalesced('coalesce_values', 'val', 'true); DELETE FROM coalesce_values; SELECT (1');
+SELECT median_coalesced('coalesce_values', 'val', 'true) FOR UPDATE --');
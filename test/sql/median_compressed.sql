@@ -0,0 +1,57 @@
+CREATE TABLE compressed_points AS
+SELECT s AS series, '2024-01-01 00:00:00+00'::timestamptz + i * interval '10 seconds' AS ts,
+       (i * 7919 % 1000)::float8 / (10 * s) AS val
+FROM generate_series(1, 3) AS s, generate_series(1, 1000) AS i;
+
+CREATE TABLE compressed_segments AS
+SELECT series, median_compress(ts, val ORDER BY ts) AS segment
+FROM compressed_points GROUP BY series;
+
+-- Same medians as over the points
+SELECT series, median_compressed(segment) AS compressed,
+       (SELECT median(val) FROM compressed_points p WHERE p.series = c.series) AS median
+FROM compressed_segments c ORDER BY series;
+
+SELECT median_compressed_agg(segment) AS compressed,
+       (SELECT median(val) FROM compressed_points) AS median
+FROM compressed_segments;
+
+-- The points come back as they went in
+SELECT count(*) AS decompressed,
+       count(*) FILTER (WHERE EXISTS (SELECT FROM compressed_points p
+                                      WHERE p.series = c.series AND p.ts = d.ts AND p.val = d.val)) AS matching
+FROM compressed_segments c, median_decompress(segment) AS d;
+
+-- Irregular timestamps and special values
+CREATE TABLE compressed_special AS
+SELECT median_compress(ts, val ORDER BY n) AS segment
+FROM (VALUES (1, '2024-01-01 00:00:00+00'::timestamptz, 1.5::float8),
+             (2, '2024-01-01 00:00:01+00', 'NaN'),
+             (3, '2024-01-01 00:00:01.5+00', 'Infinity'),
+             (4, '2024-01-01 00:00:07+00', '-Infinity'),
+             (5, '2024-06-01 00:00:00+00', '-0'),
+             (6, '1999-01-01 00:00:00+00', 1.5)) AS t(n, ts, val);
+
+SELECT ts - '2024-01-01 00:00:00+00' AS since, val
+FROM compressed_special, median_decompress(segment);
+
+SELECT median_compressed(segment) FROM compressed_special;
+
+-- No points give NULL
+SELECT median_compress(ts, val) IS NULL AS no_segment,
+       median_compressed_agg(NULL) IS NULL AS no_median
+FROM compressed_points WHERE series < 0;
+
+-- Parallel aggregation
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+SELECT median_compressed_agg(segment) FROM compressed_segments;
+
+RESET ALL;
+
+-- Invalid segments
+SELECT median_compressed('\x00');
+SELECT median_compressed(substr(segment, 1, 20)) FROM compressed_segments WHERE series = 1;
@@ -0,0 +1,36 @@
+CREATE TABLE events (ts timestamptz, counter int8);
+INSERT INTO events VALUES
+  ('2024-01-01 00:01:10+00', 5),
+  ('2024-01-01 00:00:00+00', 100),
+  ('2024-01-02 02:01:10+00', 6),
+  ('2024-01-01 00:00:30+00', 200),
+  (NULL, 999),
+  ('2024-01-01 00:00:10+00', 150),
+  ('2024-01-01 00:01:00+00', 3);
+
+-- Inter-arrival times, with ordered input or an order key
+SELECT median_delta(ts ORDER BY ts) AS ordered, median_delta(ts, ts) AS keyed,
+       median_delta(ts::timestamp, ts) AS timestamp
+FROM events;
+
+-- Counter increments, with and without reset handling. Without an order
+-- key, only NULL values are skipped, so the row without ts is filtered out.
+SELECT median_delta(counter, ts) AS delta, median_counter_delta(counter, ts) AS counter_delta,
+       median_counter_delta(counter::float8 ORDER BY ts) FILTER (WHERE ts IS NOT NULL) AS float8
+FROM events;
+
+-- Same as taking differences with lag()
+SELECT (SELECT median_delta(counter, ts) FROM events) =
+       (SELECT median(d) FROM (SELECT counter - lag(counter) OVER (ORDER BY ts) AS d
+                               FROM events WHERE ts IS NOT NULL) AS t) AS same;
+
+-- Intervals are justified like timestamp subtraction
+SELECT median_delta(ts ORDER BY ts)
+FROM (VALUES (timestamptz '2024-01-01 00:00+00'), ('2024-01-03 05:00+00')) AS t(ts);
+
+-- Fewer than two values
+SELECT median_delta(x) FROM (VALUES (1::int8)) AS t(x);
+
+-- Overflow
+SELECT median_delta(x ORDER BY x)
+FROM (VALUES (-9223372036854775807::int8), (9223372036854775807::int8)) AS t(x);
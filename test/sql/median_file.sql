@@ -0,0 +1,62 @@
+CREATE TABLE file_values AS
+SELECT i, i * 7919 % 1001 AS val, 'name ' || i || ', "quoted"' AS name
+FROM generate_series(1, 1001) AS i;
+INSERT INTO file_values (i) VALUES (0);
+
+-- Relative paths are relative to the data directory
+DO $$
+BEGIN
+    EXECUTE format('COPY file_values TO %L (FORMAT csv, HEADER)',
+                   current_setting('data_directory') || '/median_file.csv');
+    EXECUTE format('COPY file_values TO %L',
+                   current_setting('data_directory') || '/median_file.txt');
+    EXECUTE format('COPY file_values TO %L (FORMAT binary)',
+                   current_setting('data_directory') || '/median_file.bin');
+END
+$$;
+
+-- Same medians as from the table, NULLs are ignored
+SELECT median(val) FROM file_values;
+SELECT median_from_file('median_file.csv', 2, 'csv', true);
+SELECT median_from_file('median_file.txt', 2, 'text', NULL::int4);
+SELECT median_from_file('median_file.bin', 2, 'binary', NULL::int4);
+
+SELECT median_from_file('median_file.csv', 3, 'csv', NULL::text, true) = median(name) AS csv,
+       median_from_file('median_file.txt', 3, 'text', NULL::text) = median(name) AS text,
+       median_from_file('median_file.bin', 3, 'binary', NULL::text) = median(name) AS binary
+FROM file_values;
+
+-- Text format escapes are resolved as by COPY FROM, including octal and
+-- hex ones
+DO $$
+BEGIN
+    EXECUTE format('COPY (VALUES (%L), (%L)) TO %L (FORMAT csv)',
+                   '\101\x42\103\x44e\q\xz', '\N',
+                   current_setting('data_directory') || '/median_file_escapes.txt');
+END
+$$;
+SELECT median_from_file('median_file_escapes.txt', 1, 'text', NULL::text);
+
+-- Fields must be valid in the database encoding, as for COPY FROM
+DO $$
+BEGIN
+    EXECUTE format('COPY (VALUES (%L)) TO %L (FORMAT csv, ENCODING %L)',
+                   'caf' || chr(233), current_setting('data_directory') || '/median_file_latin1.csv',
+                   'LATIN1');
+END
+$$;
+SELECT median_from_file('median_file_latin1.csv', 1, 'csv', NULL::text);
+
+-- Invalid arguments
+SELECT median_from_file('median_file.csv', 4, 'csv', true);
+SELECT median_from_file('median_file.csv', 2);
+SELECT median_from_file('median_file.csv', 2, 'xml');
+SELECT median_from_file('median_file.bin', 2, 'binary', true);
+SELECT median_from_file('no_such_file.csv', 1);
+
+-- Reading files takes pg_read_server_files
+CREATE ROLE regress_median_file;
+SET ROLE regress_median_file;
+SELECT median_from_file('median_file.csv', 2, 'csv', true);
+RESET ROLE;
+DROP ROLE regress_median_file;
@@ -0,0 +1,25 @@
+SELECT median_of(3, 1, 2), median_of(4, 1, 3, 2), median_of(7);
+SELECT median_of(2.5::float8, 'NaN', -1), median_of('b'::text, 'c', 'a', 'd');
+
+-- NULLs are ignored, no values give NULL
+SELECT median_of(1, NULL, 5), median_of(NULL::int, NULL) IS NULL AS all_null,
+       median_of(VARIADIC '{}'::int[]) IS NULL AS empty;
+
+-- Same as median() over the values, for every number of values
+CREATE TABLE of_rows AS
+SELECT r, array_agg((r * 7919 + c * 104729) % 101 ORDER BY c) AS vals
+FROM generate_series(1, 200) AS r, generate_series(1, 12) AS c
+GROUP BY r;
+
+SELECT k,
+       bool_and(median_of(VARIADIC vals[1:k]) =
+                (SELECT median(v) FROM unnest(vals[1:k]) AS v)) AS int4,
+       bool_and(median_of(VARIADIC vals[1:k]::float8[]) =
+                (SELECT median(v::float8) FROM unnest(vals[1:k]) AS v)) AS float8,
+       bool_and(median_of(VARIADIC vals[1:k]::text[]) =
+                (SELECT median(v::text) FROM unnest(vals[1:k]) AS v)) AS text
+FROM of_rows, generate_series(1, 12) AS k
+GROUP BY k ORDER BY k;
+
+-- Types without ordering
+SELECT median_of('1'::xid, '2'::xid);
@@ -0,0 +1,31 @@
+SELECT x, fast_percent_rank(x) OVER (), fast_ntile(x, 3) OVER ()
+FROM (VALUES (5), (1), (NULL), (3), (1)) AS t(x);
+
+SELECT x, fast_percent_rank(x) OVER (), fast_ntile(x, 10) OVER (), fast_ntile(x, NULL) OVER ()
+FROM (VALUES ('b'::text), ('c'), ('a')) AS t(x);
+
+-- Same as the built-in functions over sorted partitions
+CREATE TABLE rank_values AS
+SELECT i, i % 7 AS g, CASE WHEN i % 17 = 0 THEN NULL ELSE i * 7919 % 50 END AS val
+FROM generate_series(1, 1000) AS i;
+
+SELECT bool_and(fast_int = builtin_int) AS int4, bool_and(fast_text = builtin_text) AS text
+FROM (SELECT fast_percent_rank(val) OVER (PARTITION BY g) AS fast_int,
+             percent_rank() OVER (PARTITION BY g ORDER BY val) AS builtin_int,
+             fast_percent_rank(val::text) OVER (PARTITION BY g) AS fast_text,
+             percent_rank() OVER (PARTITION BY g ORDER BY val::text) AS builtin_text
+      FROM rank_values) AS s;
+
+-- Buckets of the same sizes and ranges of values as ntile()
+SELECT count(*) AS differences
+FROM ((SELECT g, b, count(*), min(val), max(val)
+       FROM (SELECT g, val, fast_ntile(val, 4) OVER (PARTITION BY g) AS b
+             FROM rank_values) AS f
+       GROUP BY g, b)
+      EXCEPT
+      (SELECT g, b, count(*), min(val), max(val)
+       FROM (SELECT g, val, ntile(4) OVER (PARTITION BY g ORDER BY val) AS b
+             FROM rank_values) AS n
+       GROUP BY g, b)) AS d;
+
+SELECT fast_ntile(x, 0) OVER () FROM (VALUES (1)) AS t(x);
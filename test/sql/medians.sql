@@ -0,0 +1,32 @@
+CREATE TABLE mvals AS
+SELECT i, i * 7919 % 1000 AS a, i * 104729 % 997 - 500 AS b,
+       CASE WHEN i % 4 <> 0 THEN i % 13 END AS c
+FROM generate_series(1, 1000) AS i;
+
+-- Small example, NULLs are ignored per column
+SELECT medians(x, x * 10, -x, NULL) FROM generate_series(1, 5) AS t(x);
+
+-- Same results as separate medians
+SELECT medians(a, b, c) = ARRAY[median(a), median(b), median(c)] AS same FROM mvals;
+
+SELECT medians(val, upper(val)) FROM (VALUES ('erik'), ('mat'), ('rob'), ('lee')) AS t(val);
+
+-- Many groups
+SELECT i % 3 AS g, medians(i, -i) FROM generate_series(1, 1000) AS t(i) GROUP BY 1 ORDER BY 1;
+
+-- No rows
+SELECT medians(x, x) FROM generate_series(1, 0) AS t(x);
+
+-- Parallel aggregation
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+SELECT medians(a, b, c) = ARRAY[median(a), median(b), median(c)] AS same FROM mvals;
+
+RESET ALL;
+
+-- The number of columns must not change
+SELECT medians(VARIADIC CASE WHEN x < 3 THEN ARRAY[x] ELSE ARRAY[x, x] END)
+FROM generate_series(1, 5) AS t(x);
@@ -0,0 +1,46 @@
+CREATE TABLE pvals(val float8, g int);
+
+INSERT INTO pvals
+SELECT (i * 7919) % 1000 / 10.0, i % 3
+FROM generate_series(1, 1000) AS t(i);
+
+INSERT INTO pvals VALUES (NULL, 0), (NULL, 1);
+
+-- Small example
+SELECT fast_percentile_disc(0.5) WITHIN GROUP (ORDER BY x),
+       fast_percentile_cont(0.5) WITHIN GROUP (ORDER BY x)
+FROM generate_series(1, 4) AS t(x);
+
+-- Same results as the built-in ordered-set aggregates
+SELECT fast_percentile_disc(0.25) WITHIN GROUP (ORDER BY val)
+         = percentile_disc(0.25) WITHIN GROUP (ORDER BY val) AS disc,
+       fast_percentile_cont(0.25) WITHIN GROUP (ORDER BY val)
+         = percentile_cont(0.25) WITHIN GROUP (ORDER BY val) AS cont,
+       fast_percentile_disc(ARRAY[0, 0.1, NULL, 0.5, 1]) WITHIN GROUP (ORDER BY val)
+         = percentile_disc(ARRAY[0, 0.1, NULL, 0.5, 1]) WITHIN GROUP (ORDER BY val) AS disc_multi,
+       fast_percentile_cont(ARRAY[[0.33, 0.9], [0.5, 0.999]]) WITHIN GROUP (ORDER BY val)
+         = percentile_cont(ARRAY[[0.33, 0.9], [0.5, 0.999]]) WITHIN GROUP (ORDER BY val) AS cont_multi
+FROM pvals;
+
+SELECT g, fast_percentile_disc(0.5) WITHIN GROUP (ORDER BY val)
+            = percentile_disc(0.5) WITHIN GROUP (ORDER BY val) AS disc,
+          fast_percentile_cont(0.75) WITHIN GROUP (ORDER BY val)
+            = percentile_cont(0.75) WITHIN GROUP (ORDER BY val) AS cont
+FROM pvals GROUP BY g ORDER BY g;
+
+-- Text and interval values
+SELECT fast_percentile_disc(0.5) WITHIN GROUP (ORDER BY val)
+FROM (VALUES ('erik'), ('mat'), ('rob'), ('david'), ('lee')) AS t(val);
+
+SELECT fast_percentile_cont(0.5) WITHIN GROUP (ORDER BY d)
+         = percentile_cont(0.5) WITHIN GROUP (ORDER BY d) AS cont,
+       fast_percentile_cont(ARRAY[0.1, 0.9]) WITHIN GROUP (ORDER BY d)
+         = percentile_cont(ARRAY[0.1, 0.9]) WITHIN GROUP (ORDER BY d) AS cont_multi
+FROM (VALUES (interval '1 hour'), ('3 hours'), ('2 days'), ('5 minutes')) AS t(d);
+
+-- Empty input and NULL percentile
+SELECT fast_percentile_disc(0.5) WITHIN GROUP (ORDER BY val) FROM pvals WHERE val IS NULL;
+SELECT fast_percentile_cont(NULL) WITHIN GROUP (ORDER BY val) FROM pvals;
+
+-- Percentile out of range
+SELECT fast_percentile_disc(1.5) WITHIN GROUP (ORDER BY val) FROM pvals;
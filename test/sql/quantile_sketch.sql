@@ -0,0 +1,109 @@
+CREATE TABLE sketch_values AS
+SELECT i, (i * 7919 % 1000 - 200)::float8 AS val
+FROM generate_series(1, 1000) AS i;
+
+-- Within 1% of the exact quantiles
+SELECT q, abs(quantile_sketch_quantile(quantile_sketch(val), q) -
+              percentile_disc(q) WITHIN GROUP (ORDER BY val)) <=
+            0.01 * abs(percentile_disc(q) WITHIN GROUP (ORDER BY val)) AS accurate
+FROM sketch_values, (VALUES (0::float8), (0.1), (0.5), (0.9), (1)) AS p(q)
+GROUP BY q ORDER BY q;
+
+-- Merged sketches of parts are the sketch of the whole
+SELECT quantile_sketch_combine(a, b) = c AS combined
+FROM (SELECT quantile_sketch(val) FILTER (WHERE i % 2 = 0) AS a,
+             quantile_sketch(val) FILTER (WHERE i % 2 = 1) AS b,
+             quantile_sketch(val) AS c
+      FROM sketch_values) AS s;
+
+CREATE TABLE sketch_whole AS SELECT quantile_sketch(val) AS sketch FROM sketch_values;
+
+SELECT quantile_sketch_merge(sketch) = (SELECT sketch FROM sketch_whole) AS merged
+FROM (SELECT quantile_sketch(val) AS sketch FROM sketch_values GROUP BY i % 10) AS s;
+
+-- Parallel aggregation
+SET parallel_setup_cost = 0;
+SET parallel_tuple_cost = 0;
+SET min_parallel_table_scan_size = 0;
+SET max_parallel_workers_per_gather = 2;
+
+SELECT quantile_sketch(val) = (SELECT sketch FROM sketch_whole) AS parallel
+FROM sketch_values;
+
+RESET ALL;
+
+-- NULLs are ignored, no values give NULL
+SELECT quantile_sketch(val) IS NULL AS empty FROM (VALUES (NULL::float8)) AS t(val);
+
+-- Invalid arguments
+SELECT quantile_sketch('Infinity'::float8);
+SELECT quantile_sketch_quantile(sketch, 1.5) FROM sketch_whole;
+SELECT quantile_sketch_quantile('\x00', 0.5);
+-- Sketches with a NaN zero weight, a negative weight or a bucket range
+-- past the end of the data
+SELECT quantile_sketch_quantile('\x017ff8000000000000', 0.5);
+SELECT quantile_sketch_quantile('\x0100000000000000000000000000000001bff00000000000000000000000000000', 0.5);
+SELECT quantile_sketch_quantile('\x0100000000000000007fffffff7fffffff', 0.5);
+
+-- Rollups of ten hours of readings into hourly sketches
+CREATE TABLE readings (ts timestamptz, reading float8);
+INSERT INTO readings
+SELECT timestamptz '2024-01-01 00:00+00' + i * interval '1 minute', i * 7919 % 1000 + i / 10
+FROM generate_series(0, 599) AS i;
+
+SELECT median_rollup_add('readings', 'ts', 'reading', '1 hour') IS NOT NULL AS added;
+SELECT median_rollup_refresh();
+
+SELECT abs(median_rollup_median('readings', 'reading', '2024-01-01 00:00+00', '2024-01-02 00:00+00') -
+           percentile_disc(0.5) WITHIN GROUP (ORDER BY reading)) <=
+         0.01 * percentile_disc(0.5) WITHIN GROUP (ORDER BY reading) AS accurate
+FROM readings;
+
+SELECT abs(median_rollup_quantile('readings', 'reading', 0.9, '2024-01-01 02:00+00', '2024-01-01 05:00+00') -
+           percentile_disc(0.9) WITHIN GROUP (ORDER BY reading)) <=
+         0.01 * percentile_disc(0.9) WITHIN GROUP (ORDER BY reading) AS accurate
+FROM readings
+WHERE ts >= '2024-01-01 02:00+00' AND ts < '2024-01-01 05:00+00';
+
+-- Rolled up rows are not scanned again, so rows arriving late are left out
+INSERT INTO readings VALUES ('2024-01-01 03:30+00', 100000);
+SELECT median_rollup_refresh();
+SELECT median_rollup_quantile('readings', 'reading', 1, '2024-01-01 00:00+00', '2024-01-02 00:00+00') < 100000 AS late_row_ignored;
+
+-- Invalid configurations
+SELECT median_rollup_add('readings', 'ts', 'missing', '1 hour');
+SELECT median_rollup_add('readings', 'reading', 'ts', '1 hour');
+SELECT median_rollup_add('readings', 'ts', 'reading', '1 month');
+
+SELECT median_rollup_remove('readings', 'reading');
+SELECT count(*) FROM median_rollup_data;
+
+-- Rollups read the table as the role that registered them, and one that
+-- cannot be refreshed does not hold up the others
+CREATE ROLE regress_rollup_owner;
+GRANT SELECT ON readings TO regress_rollup_owner;
+SET ROLE regress_rollup_owner;
+SELECT median_rollup_add('readings', 'ts', 'reading', '1 hour') IS NOT NULL AS added;
+-- Only median_rollup_add() writes the configuration
+INSERT INTO median_rollup_config (relid, ts_column, val_column, bucket_width, owner)
+VALUES ('readings', 'ts', 'ts', '1 hour', 'postgres');
+RESET ROLE;
+
+CREATE TABLE more_readings (ts timestamptz, reading float8);
+INSERT INTO more_readings VALUES ('2024-01-01 00:30+00', 1), ('2024-01-01 01:30+00', 2);
+SELECT median_rollup_add('more_readings', 'ts', 'reading', '1 hour') IS NOT NULL AS added;
+
+REVOKE SELECT ON readings FROM regress_rollup_owner;
+SELECT median_rollup_refresh();
+SELECT c.relid, c.owner, c.watermark IS NOT NULL AS refreshed, count(d.bucket) AS buckets
+FROM median_rollup_config c LEFT JOIN median_rollup_data d ON d.rollup_id = c.id
+GROUP BY c.id ORDER BY c.id;
+
+-- Reading a rollup takes the SELECT privilege on its table
+GRANT SELECT ON median_rollup_config, median_rollup_data TO regress_rollup_owner;
+SET ROLE regress_rollup_owner;
+SELECT median_rollup_quantile('more_readings', 'reading', 0.5, '2024-01-01 00:00+00', '2024-01-02 00:00+00');
+RESET ROLE;
+SELECT median_rollup_remove(relid, val_column) FROM median_rollup_config ORDER BY id;
+DROP OWNED BY regress_rollup_owner;
+DROP ROLE regress_rollup_owner;